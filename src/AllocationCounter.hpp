@@ -0,0 +1,71 @@
+#ifndef _ALLOCATION_COUNTER_HPP_
+#define _ALLOCATION_COUNTER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations made through operator new, to check that a code path does not
+// allocate. Define CGEL_COUNT_ALLOCATIONS before including this header in exactly one
+// translation unit (the one with main) to replace the global operator new and delete;
+// without it the counter stays at zero. Over-aligned allocations are not counted.
+namespace cgel
+{
+    inline std::atomic<size_t> &allocation_counter()
+    {
+        static std::atomic<size_t> counter(0);
+        return counter;
+    }
+
+    // Number of allocations since the program started.
+    inline size_t getAllocationCount()
+    {
+        return allocation_counter().load(std::memory_order_relaxed);
+    }
+
+    inline bool isAllocationCountingEnabled()
+    {
+    #ifdef CGEL_COUNT_ALLOCATIONS
+        return true;
+    #else
+        return false;
+    #endif
+    }
+}
+
+#ifdef CGEL_COUNT_ALLOCATIONS
+
+void *operator new(std::size_t size)
+{
+    cgel::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    cgel::allocation_counter().fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept {std::free(p);}
+void operator delete[](void *p) noexcept {std::free(p);}
+void operator delete(void *p, std::size_t) noexcept {std::free(p);}
+void operator delete[](void *p, std::size_t) noexcept {std::free(p);}
+void operator delete(void *p, const std::nothrow_t &) noexcept {std::free(p);}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {std::free(p);}
+
+#endif
+
+#endif
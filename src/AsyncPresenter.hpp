@@ -0,0 +1,136 @@
+#ifndef _ASYNC_PRESENTER_HPP_
+#define _ASYNC_PRESENTER_HPP_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <cstddef>
+
+#include "ConsoleBackend.hpp"
+
+namespace cgel
+{
+    // Presents frames on a thread of its own, so the next frame is rendered while the last
+    // one is still being written to the console. Frames are triple buffered: the renderer
+    // owns one buffer, the presenter another, and the third holds the newest finished frame.
+    // Both sides trade buffers with a single atomic exchange, so neither waits for the other;
+    // if the console falls behind, frames it had no time for are skipped rather than queued.
+    class AsyncPresenter
+    {
+        private:
+            // m_ready holds the index of the buffer in the middle, with FRESH set while it holds
+            // a frame the presenter has not taken yet.
+            static constexpr unsigned FRESH = 4;
+            static constexpr unsigned INDEX = 3;
+
+            ConsoleBackend &m_backend;
+            const int m_width;
+            const int m_height;
+            std::vector<char> m_buffers[3];
+            unsigned m_back;
+            std::atomic<unsigned> m_ready;
+
+            // Only used to sleep while there is nothing to present; frames never pass through it.
+            // m_sleeping is set while the presenter waits, so publishing only takes the mutex to
+            // wake it and never while frames arrive faster than the console takes them.
+            mutable std::mutex m_mutex;
+            std::condition_variable m_frame_ready;
+            std::atomic<bool> m_sleeping;
+            bool m_stop;
+            PresentStats m_present_stats;
+            size_t m_presented_count;
+
+            std::thread m_thread;
+
+            void m_present()
+            {
+                unsigned front = 0;
+                while (true)
+                {
+                    if (!(m_ready.load(std::memory_order_relaxed) & FRESH))
+                    {
+                        // Sequentially consistent, so either publish() sees m_sleeping set or
+                        // this sees its frame; publish() takes the mutex before notifying, so
+                        // the wakeup cannot land between the check and the wait.
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_sleeping.store(true);
+                        m_frame_ready.wait(lock, [&]() {return m_stop || (m_ready.load() & FRESH);});
+                        m_sleeping.store(false, std::memory_order_relaxed);
+                        if (!(m_ready.load(std::memory_order_relaxed) & FRESH)) return;
+                    }
+
+                    // Take the newest frame and leave the buffer just shown in its place. Keep
+                    // going after a stop until the last published frame is out.
+                    front = m_ready.exchange(front, std::memory_order_acq_rel) & INDEX;
+                    m_backend.present(m_buffers[front].data(), m_width, m_height);
+
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_present_stats = m_backend.getPresentStats();
+                    m_presented_count++;
+                }
+            }
+
+        public:
+            // The backend must outlive the presenter and, while it runs, is only presented from
+            // the presenter's thread.
+            AsyncPresenter(ConsoleBackend &backend, const int width, const int height) :
+                m_backend(backend),
+                m_width(width),
+                m_height(height),
+                m_back(1),
+                m_ready(2),
+                m_sleeping(false),
+                m_stop(false),
+                m_present_stats{},
+                m_presented_count(0)
+            {
+                for (std::vector<char> &buffer : m_buffers) buffer.assign((size_t)width * height, ' ');
+                m_thread = std::thread(&AsyncPresenter::m_present, this);
+            }
+
+            // Presents the last published frame if it has not been shown yet.
+            ~AsyncPresenter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_frame_ready.notify_one();
+                m_thread.join();
+            }
+
+            AsyncPresenter(const AsyncPresenter &) = delete;
+            AsyncPresenter &operator= (const AsyncPresenter &) = delete;
+
+            // Copy a width x height frame and hand it to the presenter. Never blocks on the console.
+            void publish(const char *screen)
+            {
+                std::memcpy(m_buffers[m_back].data(), screen, m_buffers[m_back].size());
+                const unsigned previous = m_ready.exchange(m_back | FRESH);
+                m_back = previous & INDEX;
+
+                if (!m_sleeping.load()) return;
+                { std::lock_guard<std::mutex> lock(m_mutex); }
+                m_frame_ready.notify_one();
+            }
+
+            // What the most recently presented frame sent to the console.
+            PresentStats getPresentStats() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_present_stats;
+            }
+
+            // Frames actually written to the console; publishing faster than this skips frames.
+            size_t getPresentedCount() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_presented_count;
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,533 @@
+#ifndef _CONSOLE_BACKEND_HPP_
+#define _CONSOLE_BACKEND_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <Windows.h>
+    #include <WinCon.h>
+#else
+    #include <cstdio>
+    #include <termios.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+#endif
+
+namespace cgel
+{
+    // Full rewrites the whole frame every time. Diff keeps the previously shown frame and
+    // only sends the runs of cells that changed, which matters when output bandwidth (SSH,
+    // slow terminal emulators) limits the frame rate.
+    enum PresentMode
+    {
+        PRESENT_MODE_FULL,
+        PRESENT_MODE_DIFF
+    };
+
+    // What the last present() sent to the console.
+    struct PresentStats
+    {
+        size_t bytesWritten;
+        size_t cellsChanged;
+        size_t runCount;
+    };
+
+    namespace detail
+    {
+        // Call run(y, begin, end) for every run [begin, end) of cells in row y that differ
+        // between previous and current, both columns x rows with the given row strides. Runs
+        // separated by at most mergeGap unchanged cells are joined, since rewriting a few
+        // unchanged cells is cheaper than moving the cursor past them.
+        template<typename Run>
+        void for_each_changed_run(const char *previous, const size_t previousStride, const char *current, const size_t currentStride,
+                                  const int columns, const int rows, const int mergeGap, Run &&run)
+        {
+            for (int y = 0; y < rows; y++)
+            {
+                const char *before = previous + y * previousStride;
+                const char *after = current + y * currentStride;
+
+                int x = 0;
+                while (x < columns)
+                {
+                    while (x < columns && before[x] == after[x]) x++;
+                    if (x == columns) break;
+
+                    const int begin = x;
+                    int end = x + 1;
+                    for (x = end; x < columns; x++)
+                    {
+                        if (before[x] != after[x]) end = x + 1;
+                        else if (x - end >= mergeGap) break;
+                    }
+                    run(y, begin, end);
+                }
+            }
+        }
+    }
+
+    // Where frames are shown and keyboard state comes from. Key codes are the Windows
+    // virtual-key codes listed in Keyboard; other backends translate their input to them.
+    class ConsoleBackend
+    {
+        protected:
+            PresentMode m_present_mode = PRESENT_MODE_FULL;
+            PresentStats m_present_stats = {};
+
+        public:
+            virtual ~ConsoleBackend() = default;
+
+            void setPresentMode(const PresentMode presentMode) {m_present_mode = presentMode;}
+            PresentMode getPresentMode() const {return m_present_mode;}
+            const PresentStats &getPresentStats() const {return m_present_stats;}
+
+            // Show a width x height frame of chars, row by row.
+            virtual void present(const char *screen, int width, int height) = 0;
+
+            // Read whatever input arrived since the last call. Called once per frame.
+            virtual void pollInput() {}
+
+            virtual bool isKeyPressed(unsigned short key) const = 0;
+
+            // Size of the visible console in cells, false if it cannot be determined.
+            virtual bool getSize(int &width, int &height) const = 0;
+    };
+
+    // Renders without a console, for benchmarks and automated runs. Each presented frame is
+    // kept in memory and, given a path, also appended to that file as its rows followed by a
+    // blank line. No keys are ever pressed.
+    class HeadlessBackend : public ConsoleBackend
+    {
+        private:
+            int m_width;
+            int m_height;
+            std::vector<char> m_frame;
+            size_t m_frame_count;
+            std::ofstream m_dump;
+
+        public:
+            HeadlessBackend(const int width, const int height, const std::string &dumpPath = "") :
+                m_width(width),
+                m_height(height),
+                m_frame((size_t)width * height, ' '),
+                m_frame_count(0)
+            {
+                if (!dumpPath.empty())
+                {
+                    m_dump.open(dumpPath, std::ios::binary);
+                    if (!m_dump) throw std::runtime_error("Cannot open " + dumpPath + " for writing.");
+                }
+            }
+
+            void present(const char *screen, const int width, const int height) override
+            {
+                m_frame.assign(screen, screen + (size_t)width * height);
+                m_width = width;
+                m_height = height;
+                m_frame_count++;
+
+                m_present_stats = {m_frame.size(), m_frame.size(), 1};
+                if (m_dump.is_open())
+                {
+                    for (int y = 0; y < height; y++)
+                    {
+                        m_dump.write(screen + (size_t)y * width, width);
+                        m_dump.put('\n');
+                    }
+                    m_dump.put('\n');
+                    m_present_stats.bytesWritten = (size_t)(width + 1) * height + 1;
+                }
+            }
+
+            bool isKeyPressed(unsigned short) const override {return false;}
+
+            bool getSize(int &width, int &height) const override
+            {
+                width = m_width;
+                height = m_height;
+                return true;
+            }
+
+            // The last presented frame, width x height chars row by row.
+            const std::vector<char> &getFrame() const {return m_frame;}
+            size_t getFrameCount() const {return m_frame_count;}
+    };
+
+#ifdef _WIN32
+
+    // The Windows console: frames are written with WriteConsoleOutputCharacter and keys are
+    // read with GetAsyncKeyState.
+    class WindowsConsoleBackend : public ConsoleBackend
+    {
+        private:
+            HANDLE m_console_handle;
+            DWORD m_dw_bytes_written;
+            std::vector<char> m_previous;
+            int m_previous_width;
+            int m_previous_height;
+
+        public:
+            WindowsConsoleBackend() :
+                m_console_handle(GetStdHandle(STD_OUTPUT_HANDLE)),
+                m_dw_bytes_written(0),
+                m_previous_width(0),
+                m_previous_height(0)
+            {
+                SetConsoleActiveScreenBuffer(m_console_handle);
+            }
+
+            void present(const char *screen, const int width, const int height) override
+            {
+                const size_t cellCount = (size_t)width * height;
+                if (m_present_mode == PRESENT_MODE_DIFF && m_previous_width == width && m_previous_height == height)
+                {
+                    // Each run is its own call, which moves the cursor for free.
+                    m_present_stats = {};
+                    detail::for_each_changed_run(m_previous.data(), width, screen, width, width, height, 0, [&](const int y, const int begin, const int end)
+                    {
+                        WriteConsoleOutputCharacterA(m_console_handle, screen + (size_t)y * width + begin, end - begin, {(SHORT)begin, (SHORT)y}, &m_dw_bytes_written);
+                        m_present_stats.bytesWritten += end - begin;
+                        m_present_stats.cellsChanged += end - begin;
+                        m_present_stats.runCount++;
+                    });
+                }
+                else
+                {
+                    WriteConsoleOutputCharacterA(m_console_handle, screen, (DWORD)cellCount, {0, 0}, &m_dw_bytes_written);
+                    m_present_stats = {cellCount, cellCount, 1};
+                }
+
+                if (m_present_mode == PRESENT_MODE_DIFF)
+                {
+                    m_previous.assign(screen, screen + cellCount);
+                    m_previous_width = width;
+                    m_previous_height = height;
+                }
+                else m_previous_width = m_previous_height = 0;
+            }
+
+            bool isKeyPressed(const unsigned short key) const override
+            {
+                return GetAsyncKeyState(key) & 0x8000;
+            }
+
+            bool getSize(int &width, int &height) const override
+            {
+                CONSOLE_SCREEN_BUFFER_INFO info;
+                if (!GetConsoleScreenBufferInfo(m_console_handle, &info)) return false;
+                width = info.srWindow.Right - info.srWindow.Left + 1;
+                height = info.srWindow.Bottom - info.srWindow.Top + 1;
+                return true;
+            }
+    };
+
+#else
+
+    namespace detail
+    {
+        // Terminal settings to put back when the program exits, also from a signal handler.
+        inline struct termios &saved_terminal_settings()
+        {
+            static struct termios settings;
+            return settings;
+        }
+
+        inline void restore_terminal()
+        {
+            static const char reset[] = "\x1b[0m\x1b[?25h\r\n";
+            tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_terminal_settings());
+            if (write(STDOUT_FILENO, reset, sizeof(reset) - 1) < 0) {}
+        }
+
+        inline void restore_terminal_and_exit(const int signal)
+        {
+            restore_terminal();
+            _exit(128 + signal);
+        }
+    }
+
+    // A POSIX terminal. The TTY is put in raw mode with non-blocking reads (VMIN = VTIME = 0),
+    // and each frame goes out as a single write(): cursor home followed by the rows, cut to
+    // the terminal size reported by TIOCGWINSZ so nothing wraps or scrolls.
+    //
+    // Terminals only report key presses (with auto-repeat), never releases, so a key counts
+    // as held for KEY_HOLD_TIME after its last byte arrived. Shift is only seen through
+    // upper case letters, which also press LShift.
+    class PosixTerminalBackend : public ConsoleBackend
+    {
+        public:
+            static constexpr std::chrono::milliseconds KEY_HOLD_TIME{120};
+
+        private:
+            bool m_is_terminal;
+            std::string m_frame;
+            std::chrono::steady_clock::time_point m_key_time[256];
+
+            // The start of an escape sequence the last read cut off, finished by a later one.
+            // Over SSH an arrow key's bytes often arrive in separate reads.
+            char m_escape[16];
+            size_t m_escape_length;
+
+            // The frame currently on the terminal, as columns x rows, for diff presentation.
+            std::vector<char> m_previous;
+            int m_previous_columns;
+            int m_previous_rows;
+
+            // Append a cursor move from (fromX, fromY) to (x, y), 0 based, as few bytes as possible.
+            // fromX < 0 means the cursor position is unknown.
+            void m_move_cursor(const int fromX, const int fromY, const int x, const int y)
+            {
+                char absolute[32];
+                const int absoluteLength = snprintf(absolute, sizeof(absolute), "\x1b[%d;%dH", y + 1, x + 1);
+
+                char relative[32];
+                int relativeLength = sizeof(relative);
+                if (fromX >= 0 && fromY == y && x > fromX)
+                    relativeLength = x - fromX == 1 ? snprintf(relative, sizeof(relative), "\x1b[C") : snprintf(relative, sizeof(relative), "\x1b[%dC", x - fromX);
+                else if (fromX >= 0 && fromY + 1 == y && x == 0)
+                    relativeLength = snprintf(relative, sizeof(relative), "\r\n");
+                else if (fromX >= 0 && fromY == y && x == 0)
+                    relativeLength = snprintf(relative, sizeof(relative), "\r");
+
+                if (relativeLength < absoluteLength) m_frame.append(relative, relativeLength);
+                else m_frame.append(absolute, absoluteLength);
+            }
+
+            void m_press(const unsigned short key, const std::chrono::steady_clock::time_point now)
+            {
+                m_key_time[key & 0xFF] = now;
+            }
+
+            // Length of the escape sequence starting with the ESC at input[0], or 0 if input
+            // ends before it does. CSI sequences (ESC [) may carry parameters before their final
+            // byte; an ESC not followed by [ or O is a key of its own.
+            static size_t m_escape_sequence_length(const char *input, const size_t count)
+            {
+                if (count < 2) return 0;
+                if (input[1] == 'O') return count < 3 ? 0 : 3;
+                if (input[1] != '[') return 1;
+                for (size_t i = 2; i < count; i++)
+                {
+                    if (input[i] >= 0x40 && input[i] <= 0x7E) return i + 1;
+                    if (input[i] < 0x20 || input[i] > 0x3F) return i;
+                }
+                return 0;
+            }
+
+            // Press the keys in input and return how many bytes were used, which is less than
+            // count when input ends in the middle of an escape sequence.
+            size_t m_decode_input(const char *input, const size_t count, const std::chrono::steady_clock::time_point now)
+            {
+                size_t i = 0;
+                while (i < count)
+                {
+                    const char c = input[i];
+                    if (c == '\x1b')
+                    {
+                        size_t length = m_escape_sequence_length(input + i, count - i);
+                        if (length == 0)
+                        {
+                            // Keep the unfinished sequence for the next read, unless it is too
+                            // long to be one that is decoded.
+                            if (count - i < sizeof(m_escape)) return i;
+                            length = count - i;
+                        }
+
+                        // Arrow keys: ESC [ A..D, or ESC O A..D in application mode, with or
+                        // without modifier parameters.
+                        if (length >= 3)
+                        {
+                            switch (input[i + length - 1])
+                            {
+                                case 'A': m_press(0x26, now); break; // Up
+                                case 'B': m_press(0x28, now); break; // Down
+                                case 'C': m_press(0x27, now); break; // Right
+                                case 'D': m_press(0x25, now); break; // Left
+                            }
+                        }
+                        i += length;
+                        continue;
+                    }
+
+                    if (c >= 'a' && c <= 'z') m_press((unsigned short)(c - 'a' + 'A'), now);
+                    else if (c >= 'A' && c <= 'Z')
+                    {
+                        m_press((unsigned short)c, now);
+                        m_press(0xA0, now); // LShift
+                    }
+                    else if (c >= '0' && c <= '9') m_press((unsigned short)c, now);
+                    else if (c == ' ') m_press(0x20, now);
+                    else if (c == '\t') m_press(0x09, now);
+                    else if (c == '\r' || c == '\n') m_press(0x0D, now);
+                    else if (c == 127 || c == '\b') m_press(0x08, now);
+                    i++;
+                }
+                return count;
+            }
+
+        public:
+            PosixTerminalBackend() :
+                m_is_terminal(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)),
+                m_escape_length(0),
+                m_previous_columns(0),
+                m_previous_rows(0)
+            {
+                std::fill(m_key_time, m_key_time + 256, std::chrono::steady_clock::time_point());
+                if (!m_is_terminal) return;
+
+                tcgetattr(STDIN_FILENO, &detail::saved_terminal_settings());
+                struct termios raw = detail::saved_terminal_settings();
+                raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+                raw.c_oflag &= ~(OPOST);
+                raw.c_cflag |= CS8;
+                // Keep ISIG so Ctrl+C still interrupts; the handlers below restore the terminal.
+                raw.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+                raw.c_cc[VMIN] = 0;
+                raw.c_cc[VTIME] = 0;
+                tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+                signal(SIGINT, detail::restore_terminal_and_exit);
+                signal(SIGTERM, detail::restore_terminal_and_exit);
+                signal(SIGHUP, detail::restore_terminal_and_exit);
+
+                // Hide the cursor and clear the screen.
+                static const char setup[] = "\x1b[?25l\x1b[2J";
+                if (write(STDOUT_FILENO, setup, sizeof(setup) - 1) < 0) {}
+            }
+
+            ~PosixTerminalBackend() override
+            {
+                if (!m_is_terminal) return;
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGHUP, SIG_DFL);
+                detail::restore_terminal();
+            }
+
+            PosixTerminalBackend(const PosixTerminalBackend &) = delete;
+            PosixTerminalBackend &operator= (const PosixTerminalBackend &) = delete;
+
+            void present(const char *screen, const int width, const int height) override
+            {
+                int columns = width, rows = height;
+                int terminalWidth, terminalHeight;
+                if (getSize(terminalWidth, terminalHeight))
+                {
+                    columns = std::min(columns, terminalWidth);
+                    rows = std::min(rows, terminalHeight);
+                }
+
+                // Assemble the whole frame first so the terminal gets it in one write.
+                m_frame.clear();
+                m_present_stats = {};
+                if (m_present_mode == PRESENT_MODE_DIFF && m_previous_columns == columns && m_previous_rows == rows)
+                {
+                    // Track the cursor so moves can be relative. Writing the last column leaves
+                    // it in the terminal's pending wrap state, so its position is then unknown.
+                    int cursorX = -1, cursorY = -1;
+                    detail::for_each_changed_run(m_previous.data(), columns, screen, width, columns, rows, 4, [&](const int y, const int begin, const int end)
+                    {
+                        m_move_cursor(cursorX, cursorY, begin, y);
+                        m_frame.append(screen + (size_t)y * width + begin, end - begin);
+                        cursorX = end < columns ? end : -1;
+                        cursorY = y;
+                        m_present_stats.cellsChanged += end - begin;
+                        m_present_stats.runCount++;
+                    });
+                }
+                else
+                {
+                    // A fresh or resized terminal starts from a cleared screen.
+                    m_frame.reserve(7 + (size_t)rows * (columns + 2));
+                    m_frame.append(m_present_mode == PRESENT_MODE_DIFF ? "\x1b[2J\x1b[H" : "\x1b[H");
+                    for (int y = 0; y < rows; y++)
+                    {
+                        m_frame.append(screen + (size_t)y * width, columns);
+                        if (y + 1 < rows) m_frame.append("\r\n");
+                    }
+                    m_present_stats.cellsChanged = (size_t)rows * columns;
+                    m_present_stats.runCount = rows;
+                }
+                m_present_stats.bytesWritten = m_frame.size();
+
+                if (m_present_mode == PRESENT_MODE_DIFF)
+                {
+                    m_previous.resize((size_t)rows * columns);
+                    for (int y = 0; y < rows; y++)
+                        std::memcpy(m_previous.data() + (size_t)y * columns, screen + (size_t)y * width, columns);
+                    m_previous_columns = columns;
+                    m_previous_rows = rows;
+                }
+                else m_previous_columns = m_previous_rows = 0;
+
+                const char *data = m_frame.data();
+                size_t remaining = m_frame.size();
+                while (remaining > 0)
+                {
+                    const ssize_t written = write(STDOUT_FILENO, data, remaining);
+                    if (written <= 0) break;
+                    data += written;
+                    remaining -= (size_t)written;
+                }
+            }
+
+            void pollInput() override
+            {
+                if (!m_is_terminal) return;
+
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                char input[sizeof(m_escape) + 256];
+                size_t count = m_escape_length;
+                std::memcpy(input, m_escape, m_escape_length);
+                ssize_t received;
+                while ((received = read(STDIN_FILENO, input + count, sizeof(input) - count)) > 0)
+                {
+                    count += received;
+                    const size_t used = m_decode_input(input, count, now);
+                    count -= used;
+                    std::memmove(input, input + used, count);
+                }
+                std::memcpy(m_escape, input, count);
+                m_escape_length = count;
+            }
+
+            bool isKeyPressed(const unsigned short key) const override
+            {
+                return std::chrono::steady_clock::now() < m_key_time[key & 0xFF] + KEY_HOLD_TIME;
+            }
+
+            bool getSize(int &width, int &height) const override
+            {
+                struct winsize size;
+                if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0) return false;
+                width = size.ws_col;
+                height = size.ws_row;
+                return true;
+            }
+    };
+
+#endif
+
+    // The backend for the platform this is compiled for.
+    inline std::unique_ptr<ConsoleBackend> makeConsoleBackend()
+    {
+    #ifdef _WIN32
+        return std::make_unique<WindowsConsoleBackend>();
+    #else
+        return std::make_unique<PosixTerminalBackend>();
+    #endif
+    }
+}
+
+#endif
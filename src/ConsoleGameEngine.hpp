@@ -8,104 +8,286 @@
 #include <chrono>
 #include <cmath>
 #include <array>
+#include <type_traits>
+#include <limits>
+#include <cstdio>
 
-#include <stdio.h>
-#include <Windows.h>
-#include <WinCon.h>
+#include <memory>
 
 #include "MathUtil.hpp"
 #include "MiscUtil.hpp"
+#include "ConsoleBackend.hpp"
+#include "AsyncPresenter.hpp"
+#include "FrameProfiler.hpp"
 
 namespace cgel 
 {
+    // Inclusive rectangle of screen cells.
+    struct ScreenRect
+    {
+        long left;
+        long top;
+        long right;
+        long bottom;
+    };
+
     class ConsoleGameEngine 
     {
         private:
-            std::array<long, 2> *m_contour_x;
-            LPSTR m_screen_buffer;
-            HANDLE m_console_handle;
-            DWORD m_dw_bytes_written;
-            SMALL_RECT m_rect_window;
-        
-            void m_scan_line(long x1, long y1, long x2, long y2) {
+            std::unique_ptr<ConsoleBackend> m_backend;
+            std::unique_ptr<AsyncPresenter> m_presenter;
+            char *m_screen_buffer;
+            float *m_depth_buffer;
+            bool m_depth_test;
+            bool m_profiler_overlay;
 
-                long sx, sy, dx1, dy1, dx2, dy2, x, y, m, n, k, cnt;
+            // Write the last frame's stage times and counters over the top two rows.
+            void m_drawProfilerOverlay()
+            {
+                char line[256];
+                int length = std::snprintf(line, sizeof(line), "frame %.3fms", m_profiler.getFrameMilliseconds());
+                for (int stage = 0; stage < PROFILE_STAGE_COUNT && length < (int)sizeof(line); stage++)
+                    length += std::snprintf(line + length, sizeof(line) - length, " %s %.3f", FrameProfiler::getStageName((ProfileStage)stage),
+                                            m_profiler.getStageMilliseconds((ProfileStage)stage));
+                m_drawOverlayLine(0, line);
 
-                sx = x2 - x1;
-                sy = y2 - y1;
+                length = 0;
+                for (int counter = 0; counter < PROFILE_COUNTER_COUNT && length < (int)sizeof(line); counter++)
+                    length += std::snprintf(line + length, sizeof(line) - length, "%s%s %zu", counter ? " " : "", FrameProfiler::getCounterName((ProfileCounter)counter),
+                                            m_profiler.getCounter((ProfileCounter)counter));
+                m_drawOverlayLine(1, line);
+            }
 
-                if (sx > 0) dx1 = 1;
-                else if (sx < 0) dx1 = -1;
-                else dx1 = 0;
+            void m_drawOverlayLine(const int row, const char *text)
+            {
+                if (row >= m_screen_height) return;
+                char *screen = m_screen_buffer + row * m_screen_width;
+                int x = 0;
+                for (; x < m_screen_width && text[x]; x++) screen[x] = text[x];
+                for (; x < m_screen_width; x++) screen[x] = ' ';
+            }
+        
+            // Rasterize p1 p2 p3 (screen x, y and depth z, smaller is closer) with edge functions.
+            // Cell (x, y) is covered when the point (x, y) is inside the triangle, and cells on an
+            // edge shared by two triangles belong to exactly one of them (top-left rule). Only the
+            // triangle's bounding box is visited, 8 cells at a time with AVX or 4 with SSE. For every
+            // covered cell that passes the depth test, fragment(x, y, b1, b2, b3) returns the char
+            // to write, given the screen space barycentric weights of p1, p2 and p3. Nothing outside
+            // scissor is touched, so triangles can be drawn into disjoint rectangles concurrently.
+            template<typename Fragment>
+            void m_rasterize(Vec3f p1, Vec3f p2, Vec3f p3, const ScreenRect &scissor, const bool depthTest, Fragment &&fragment)
+            {
+                // Twice the signed area. Wind the triangle so the inside is positive.
+                float area = (p2.X() - p1.X()) * (p3.Y() - p1.Y()) - (p2.Y() - p1.Y()) * (p3.X() - p1.X());
+                if (!(std::fabs(area) > 0)) return;
 
-                if (sy > 0) dy1 = 1;
-                else if (sy < 0) dy1 = -1;
-                else dy1 = 0;
+                const bool swapped = area < 0;
+                if (swapped)
+                {
+                    std::swap(p2, p3);
+                    area = -area;
+                }
 
-                m = std::labs(sx);
-                n = std::labs(sy);
-                dx2 = dx1;
-                dy2 = 0;
+                const long xBegin = std::max((long)std::ceil(std::min(p1.X(), std::min(p2.X(), p3.X()))), scissor.left);
+                const long yBegin = std::max((long)std::ceil(std::min(p1.Y(), std::min(p2.Y(), p3.Y()))), scissor.top);
+                const long xEnd = std::min((long)std::floor(std::max(p1.X(), std::max(p2.X(), p3.X()))), scissor.right);
+                const long yEnd = std::min((long)std::floor(std::max(p1.Y(), std::max(p2.Y(), p3.Y()))), scissor.bottom);
+                if (xBegin > xEnd || yBegin > yEnd) return;
 
-                if (m < n)
+                // Edge i is e_i(x, y) = a[i] * x + b[i] * y + c[i]. It is zero on the edge opposite
+                // vertex i and equals area at vertex i, so e_i / area is that vertex's weight.
+                const Vec3f *vertex[3] = {&p1, &p2, &p3};
+                float a[3], b[3], c[3], invA[3];
+                bool topLeft[3];
+                for (int i = 0; i < 3; i++)
                 {
-                    m = std::labs(sy);
-                    n = std::labs(sx);
-                    dx2 = 0;
-                    dy2 = dy1;
+                    const Vec3f &from = *vertex[(i + 1) % 3];
+                    const Vec3f &to = *vertex[(i + 2) % 3];
+                    a[i] = from.Y() - to.Y();
+                    b[i] = to.X() - from.X();
+                    c[i] = -(a[i] * from.X() + b[i] * from.Y());
+                    invA[i] = a[i] != 0 ? 1 / a[i] : 0;
+
+                    // The inside lies towards +(a, b): a left edge faces +x, a top edge is horizontal and faces +y.
+                    topLeft[i] = a[i] > 0 || (a[i] == 0 && b[i] > 0);
                 }
 
-                x = x1; y = y1;
-                cnt = m + 1;
-                k = n / 2;
+                // Depth is linear in screen space: z(x, y) = zA * x + zB * y + zC.
+                const float invArea = 1 / area;
+                const float zA = (a[0] * p1.Z() + a[1] * p2.Z() + a[2] * p3.Z()) * invArea;
+                const float zB = (b[0] * p1.Z() + b[1] * p2.Z() + b[2] * p3.Z()) * invArea;
+                const float zC = (c[0] * p1.Z() + c[1] * p2.Z() + c[2] * p3.Z()) * invArea;
 
-                while (cnt--)
+                for (long y = yBegin; y <= yEnd; y++)
                 {
-                    if ((y >= 0) && (y < m_screen_height))
+                    const float fy = (float)y;
+                    const float row0 = b[0] * fy + c[0];
+                    const float row1 = b[1] * fy + c[1];
+                    const float row2 = b[2] * fy + c[2];
+                    const float rowZ = zB * fy + zC;
+
+                    // Narrow the bounding box to this row's span, widened by a cell to absorb rounding.
+                    // The per-cell edge tests below stay exact.
+                    long xFirst = xBegin, xLast = xEnd;
+                    const float row[3] = {row0, row1, row2};
+                    for (int i = 0; i < 3; i++)
+                    {
+                        if (a[i] > 0) xFirst = std::max(xFirst, (long)std::ceil(-row[i] * invA[i]) - 1);
+                        else if (a[i] < 0) xLast = std::min(xLast, (long)std::floor(-row[i] * invA[i]) + 1);
+                    }
+                    if (xFirst > xLast) continue;
+
+                    char *screen = m_screen_buffer + y * m_screen_width;
+                    float *depth = m_depth_buffer + y * m_screen_width;
+
+                    // Write a cell that is known to be covered and visible.
+                    auto shade = [&](const long x)
+                    {
+                        const float fx = (float)x;
+                        float b1 = (a[0] * fx + row0) * invArea;
+                        float b2 = (a[1] * fx + row1) * invArea;
+                        float b3 = (a[2] * fx + row2) * invArea;
+                        if (swapped) std::swap(b2, b3);
+                        screen[x] = fragment(x, y, b1, b2, b3);
+                    };
+
+                    long x = xFirst;
+
+                #if defined(CGEL_AVX)
                     {
-                        if (x < m_contour_x[y][0]) m_contour_x[y][0] = x;
-                        if (x > m_contour_x[y][1]) m_contour_x[y][1] = x;
+                        const __m256 zero = _mm256_setzero_ps();
+                        const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+                        auto inside = [&](const __m256 e, const bool edgeTopLeft)
+                        {
+                            return edgeTopLeft ? _mm256_cmp_ps(e, zero, _CMP_GE_OQ) : _mm256_cmp_ps(e, zero, _CMP_GT_OQ);
+                        };
+
+                        // The last group of a row is masked to the bounding box, so AVX finishes every row.
+                        for (; x <= xLast; x += 8)
+                        {
+                            const __m256 fx = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+                            const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a[0]), fx), _mm256_set1_ps(row0));
+                            const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a[1]), fx), _mm256_set1_ps(row1));
+                            const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(a[2]), fx), _mm256_set1_ps(row2));
+                            __m256 mask = _mm256_and_ps(_mm256_and_ps(inside(e0, topLeft[0]), inside(e1, topLeft[1])), inside(e2, topLeft[2]));
+                            mask = _mm256_and_ps(mask, _mm256_cmp_ps(fx, _mm256_set1_ps((float)xLast), _CMP_LE_OQ));
+                            if (_mm256_movemask_ps(mask) == 0) continue;
+
+                            if (depthTest)
+                            {
+                                const __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(zA), fx), _mm256_set1_ps(rowZ));
+                                const __m256 d = _mm256_maskload_ps(depth + x, _mm256_castps_si256(mask));
+                                mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, d, _CMP_LT_OQ));
+                                _mm256_maskstore_ps(depth + x, _mm256_castps_si256(mask), z);
+                            }
+
+                            const int bits = _mm256_movemask_ps(mask);
+                            for (int i = 0; i < 8; i++)
+                                if (bits & (1 << i)) shade(x + i);
+                        }
                     }
+                #endif
 
-                    k += n;
-                    if (k < m)
+                #if defined(CGEL_SSE) && !defined(CGEL_AVX)
                     {
-                        x += dx2;
-                        y += dy2;
+                        const __m128 zero = _mm_setzero_ps();
+                        const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+                        auto inside = [&](const __m128 e, const bool edgeTopLeft)
+                        {
+                            return edgeTopLeft ? _mm_cmpge_ps(e, zero) : _mm_cmpgt_ps(e, zero);
+                        };
+
+                        for (; x + 3 <= xLast; x += 4)
+                        {
+                            const __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+                            const __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), fx), _mm_set1_ps(row0));
+                            const __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), fx), _mm_set1_ps(row1));
+                            const __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), fx), _mm_set1_ps(row2));
+                            __m128 mask = _mm_and_ps(_mm_and_ps(inside(e0, topLeft[0]), inside(e1, topLeft[1])), inside(e2, topLeft[2]));
+                            if (_mm_movemask_ps(mask) == 0) continue;
+
+                            if (depthTest)
+                            {
+                                const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), fx), _mm_set1_ps(rowZ));
+                                const __m128 d = _mm_loadu_ps(depth + x);
+                                mask = _mm_and_ps(mask, _mm_cmplt_ps(z, d));
+                                _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+                            }
+
+                            const int bits = _mm_movemask_ps(mask);
+                            for (int i = 0; i < 4; i++)
+                                if (bits & (1 << i)) shade(x + i);
+                        }
                     }
-                    else
+                #endif
+
+                    for (; x <= xLast; x++)
                     {
-                        k -= m;
-                        x += dx1;
-                        y += dy1;
+                        const float fx = (float)x;
+                        const float e0 = a[0] * fx + row0;
+                        const float e1 = a[1] * fx + row1;
+                        const float e2 = a[2] * fx + row2;
+                        if (!(e0 > 0 || (e0 == 0 && topLeft[0])) ||
+                            !(e1 > 0 || (e1 == 0 && topLeft[1])) ||
+                            !(e2 > 0 || (e2 == 0 && topLeft[2])))
+                        {
+                            continue;
+                        }
+
+                        if (depthTest)
+                        {
+                            const float z = zA * fx + rowZ;
+                            if (!(z < depth[x])) continue;
+                            depth[x] = z;
+                        }
+                        shade(x);
                     }
                 }
-                
             }
 
 
         protected:
             int m_screen_width;
             int m_screen_height;
+            FrameProfiler m_profiler;
 
 
         public:
-            ConsoleGameEngine(const unsigned width, const unsigned height) :
+            // A width or height of 0 takes that size from the console. Without a backend, the
+            // platform's own console is used.
+            ConsoleGameEngine(const unsigned width, const unsigned height, std::unique_ptr<ConsoleBackend> backend = nullptr) :
+                m_backend(backend ? std::move(backend) : makeConsoleBackend()),
+                m_depth_test(true),
+                m_profiler_overlay(false),
                 m_screen_width(width),
-                m_screen_height(height),
-                m_contour_x(new std::array<long, 2>[height]),
-                m_screen_buffer(new char[width * height]),
-                m_console_handle(GetStdHandle(STD_OUTPUT_HANDLE)),//CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL)),
-                m_dw_bytes_written(0),
-                m_rect_window{0, 0, 1, 1} 
-                {SetConsoleActiveScreenBuffer(m_console_handle);}   
+                m_screen_height(height)
+            {
+                int consoleWidth = 80, consoleHeight = 24;
+                if (m_screen_width == 0 || m_screen_height == 0) m_backend->getSize(consoleWidth, consoleHeight);
+                if (m_screen_width == 0) m_screen_width = consoleWidth;
+                if (m_screen_height == 0) m_screen_height = consoleHeight;
+
+                m_screen_buffer = new char[m_screen_width * m_screen_height];
+                m_depth_buffer = new float[m_screen_width * m_screen_height];
+                Keyboard::setBackend(m_backend.get());
+            }
             
             ~ConsoleGameEngine() 
             { 
-                delete[] m_contour_x;
+                m_presenter.reset();
+                if (Keyboard::getBackend() == m_backend.get()) Keyboard::setBackend(nullptr);
                 delete[] m_screen_buffer;
+                delete[] m_depth_buffer;
             }
 
+            ConsoleGameEngine(const ConsoleGameEngine &) = delete;
+            ConsoleGameEngine &operator= (const ConsoleGameEngine &) = delete;
+
+            ConsoleBackend &getBackend() {return *m_backend;}
+
+            int getScreenWidth() const {return m_screen_width;}
+            int getScreenHeight() const {return m_screen_height;}
+
             char &at(const unsigned i) {return m_screen_buffer[i];}
             void setAsciiChar(const unsigned i, const unsigned j, const char asciiChar) 
             {
@@ -119,44 +301,104 @@ namespace cgel
 
             void display() 
             {
-                m_screen_buffer[m_screen_width * m_screen_height - 1] = '\0';
-                WriteConsoleOutputCharacter(m_console_handle, (LPSTR)m_screen_buffer, m_screen_width * m_screen_height, {0, 0}, &m_dw_bytes_written);
+                if (m_profiler_overlay) m_drawProfilerOverlay();
+
+                CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_PRESENT);
+                if (m_presenter) m_presenter->publish(m_screen_buffer);
+                else m_backend->present(m_screen_buffer, m_screen_width, m_screen_height);
+            }
+
+            // Stage times and counters of the last completed frame. With async presentation,
+            // present only covers handing the frame over.
+            const FrameProfiler &getProfiler() const {return m_profiler;}
+
+            // Draw the profiler's figures into the top two rows on display(). Off by default.
+            void setProfilerOverlay(const bool profilerOverlay) {m_profiler_overlay = profilerOverlay;}
+            bool getProfilerOverlay() const {return m_profiler_overlay;}
+
+            // With async presentation, display() only hands the frame to a presenter thread and
+            // returns, so rendering the next frame overlaps writing this one to the console.
+            // Frames the console cannot keep up with are skipped. Off by default.
+            void setAsyncPresent(const bool asyncPresent)
+            {
+                if (asyncPresent == (bool)m_presenter) return;
+                if (asyncPresent) m_presenter.reset(new AsyncPresenter(*m_backend, m_screen_width, m_screen_height));
+                else m_presenter.reset();
             }
+            bool getAsyncPresent() const {return (bool)m_presenter;}
+
+            void setPresentMode(const PresentMode presentMode)
+            {
+                // The presenter thread reads the mode, so stop it while the mode changes.
+                const bool asyncPresent = getAsyncPresent();
+                setAsyncPresent(false);
+                m_backend->setPresentMode(presentMode);
+                setAsyncPresent(asyncPresent);
+            }
+            PresentMode getPresentMode() const {return m_backend->getPresentMode();}
+
+            // Bytes, changed cells and runs sent by the last frame that reached the console.
+            PresentStats getPresentStats() const {return m_presenter ? m_presenter->getPresentStats() : m_backend->getPresentStats();}
+
+            // Read pending keyboard input; call once per frame before checking keys.
+            void pollInput() {m_backend->pollInput();}
+
+            // Depth testing is on by default. With it off, triangles simply overwrite each other
+            // and the caller is responsible for drawing them back to front.
+            void setDepthTest(const bool depthTest) {m_depth_test = depthTest;}
+            bool getDepthTest() const {return m_depth_test;}
+
+            float getDepth(const unsigned i, const unsigned j) const {return m_depth_buffer[i * m_screen_width + j];}
+
+            ScreenRect getScreenRect() const {return {0, 0, (long)m_screen_width - 1, (long)m_screen_height - 1};}
 
             void clear() {
                 for (unsigned i = 0; i < m_screen_width * m_screen_height; i++) {
                     m_screen_buffer[i] = ' ';
+                    m_depth_buffer[i] = std::numeric_limits<float>::infinity();
                 }
             }
-            
-            void drawTriangle(const Vec2f &p1, const Vec2f &p2, const Vec2f &p3, const char asciiChar) 
+
+            // Clear only the cells inside rect, which must lie on the screen.
+            void clear(const ScreenRect &rect)
             {
-                int y;
-                for (y = 0; y < m_screen_height; y++)
+                for (long y = rect.top; y <= rect.bottom; y++)
                 {
-                    m_contour_x[y][0] = LONG_MAX; // min X
-                    m_contour_x[y][1] = LONG_MIN; // max X
+                    std::fill(m_screen_buffer + y * m_screen_width + rect.left, m_screen_buffer + y * m_screen_width + rect.right + 1, ' ');
+                    std::fill(m_depth_buffer + y * m_screen_width + rect.left, m_depth_buffer + y * m_screen_width + rect.right + 1, std::numeric_limits<float>::infinity());
                 }
+            }
+            
+            // Solid fill without depth testing.
+            void drawTriangle(const Vec2f &p1, const Vec2f &p2, const Vec2f &p3, const char asciiChar) 
+            {
+                m_rasterize(Vec3f{p1.X(), p1.Y(), 0}, Vec3f{p2.X(), p2.Y(), 0}, Vec3f{p3.X(), p3.Y(), 0}, getScreenRect(), false,
+                            [asciiChar](long, long, float, float, float) {return asciiChar;});
+            }
 
-                m_scan_line(p1.X(), p1.Y(), p2.X(), p2.Y());
-                m_scan_line(p2.X(), p2.Y(), p3.X(), p3.Y());
-                m_scan_line(p3.X(), p3.Y(), p1.X(), p1.Y());
-
-                for (y = 0; y < m_screen_height; y++)
-                {
-                    if (m_contour_x[y][1] >= m_contour_x[y][0])
-                    {
-                        long x = m_contour_x[y][0];
-                        long len = 1 + m_contour_x[y][1] - m_contour_x[y][0];
+            // Solid fill. Screen space x, y plus a depth in z (smaller is closer), tested per cell
+            // against the depth buffer when depth testing is on.
+            void drawTriangle(const Vec3f &p1, const Vec3f &p2, const Vec3f &p3, const char asciiChar)
+            {
+                m_rasterize(p1, p2, p3, getScreenRect(), m_depth_test,
+                            [asciiChar](long, long, float, float, float) {return asciiChar;});
+            }
 
-                        while (len--)
-                        {
-                            setAsciiChar(y, x++, asciiChar);
+            // Same, limited to the cells inside scissor (which must lie on the screen).
+            void drawTriangle(const Vec3f &p1, const Vec3f &p2, const Vec3f &p3, const char asciiChar, const ScreenRect &scissor)
+            {
+                m_rasterize(p1, p2, p3, scissor, m_depth_test,
+                            [asciiChar](long, long, float, float, float) {return asciiChar;});
+            }
 
-                        }
-                    }
-                }
-          }
+            // Fill with a char computed per cell from interpolated attributes. fragment is called as
+            // fragment(x, y, b1, b2, b3) and returns the char for cell (x, y); b1, b2 and b3 are the
+            // weights of p1, p2 and p3, so an attribute interpolates as b1 * v1 + b2 * v2 + b3 * v3.
+            template<typename Fragment, typename = std::enable_if_t<std::is_invocable<Fragment &, long, long, float, float, float>::value>>
+            void drawTriangle(const Vec3f &p1, const Vec3f &p2, const Vec3f &p3, Fragment &&fragment)
+            {
+                m_rasterize(p1, p2, p3, getScreenRect(), m_depth_test, std::forward<Fragment>(fragment));
+            }
     };
 }
 
@@ -0,0 +1,133 @@
+#ifndef _FRAME_ARENA_HPP_
+#define _FRAME_ARENA_HPP_
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace cgel
+{
+    // Bump allocator for data that lives for one frame. Allocation is a pointer increment
+    // and nothing is freed individually; reset() releases everything at once. When a frame
+    // outgrows the arena, another block is added, and the next reset() replaces all blocks
+    // with a single one big enough for the whole frame, so a steady scene stops allocating
+    // after its first frame or two.
+    class FrameArena
+    {
+        private:
+            struct Block
+            {
+                std::unique_ptr<char[]> data;
+                size_t size;
+            };
+
+            std::vector<Block> m_blocks;
+            size_t m_block;
+            size_t m_offset;
+            size_t m_used;
+            size_t m_peak;
+
+            void m_add_block(const size_t minimumSize)
+            {
+                const size_t size = std::max(minimumSize, m_blocks.empty() ? (size_t)0 : 2 * m_blocks.back().size);
+                m_blocks.push_back(Block{std::unique_ptr<char[]>(new char[size]), size});
+            }
+
+        public:
+            explicit FrameArena(const size_t initialSize = 1 << 20) :
+                m_block(0),
+                m_offset(0),
+                m_used(0),
+                m_peak(0)
+            {
+                m_add_block(initialSize);
+            }
+
+            FrameArena(const FrameArena &) = delete;
+            FrameArena &operator= (const FrameArena &) = delete;
+
+            // size bytes aligned to alignment, which must be a power of two.
+            void *allocate(const size_t size, const size_t alignment = alignof(std::max_align_t))
+            {
+                while (true)
+                {
+                    Block &block = m_blocks[m_block];
+                    const uintptr_t base = (uintptr_t)block.data.get();
+                    const size_t offset = (size_t)(((base + m_offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+                    if (offset + size <= block.size)
+                    {
+                        m_used += offset + size - m_offset;
+                        m_offset = offset + size;
+                        m_peak = std::max(m_peak, m_used);
+                        return block.data.get() + offset;
+                    }
+
+                    // Account for the unused tail so the block size chosen on reset covers it.
+                    m_used += block.size - m_offset;
+                    m_offset = 0;
+                    if (++m_block == m_blocks.size()) m_add_block(size + alignment);
+                }
+            }
+
+            template<typename T>
+            T *allocateArray(const size_t count)
+            {
+                return (T *)allocate(count * sizeof(T), alignof(T));
+            }
+
+            // Release everything allocated since the last reset. Pointers into the arena are
+            // invalid afterwards.
+            void reset()
+            {
+                if (m_blocks.size() > 1)
+                {
+                    m_blocks.clear();
+                    m_add_block(m_peak);
+                }
+                m_block = 0;
+                m_offset = 0;
+                m_used = 0;
+            }
+
+            size_t getCapacity() const
+            {
+                size_t capacity = 0;
+                for (const Block &block : m_blocks) capacity += block.size;
+                return capacity;
+            }
+
+            size_t getPeakUsage() const {return m_peak;}
+    };
+
+    // Standard allocator over a FrameArena, for containers that only live for one frame.
+    // deallocate() is a no-op, and such containers must be emptied before the arena is reset.
+    template<typename T>
+    class ArenaAllocator
+    {
+        private:
+            FrameArena *m_arena;
+
+            template<typename U> friend class ArenaAllocator;
+
+        public:
+            using value_type = T;
+
+            explicit ArenaAllocator(FrameArena &arena) : m_arena(&arena) {}
+
+            template<typename U>
+            ArenaAllocator(const ArenaAllocator<U> &t) : m_arena(t.m_arena) {}
+
+            T *allocate(const size_t count) {return m_arena->allocateArray<T>(count);}
+            void deallocate(T *, size_t) {}
+
+            template<typename U>
+            bool operator== (const ArenaAllocator<U> &t) const {return m_arena == t.m_arena;}
+
+            template<typename U>
+            bool operator!= (const ArenaAllocator<U> &t) const {return m_arena != t.m_arena;}
+    };
+}
+
+#endif
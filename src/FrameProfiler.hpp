@@ -0,0 +1,134 @@
+#ifndef _FRAME_PROFILER_HPP_
+#define _FRAME_PROFILER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Per-stage frame timing and triangle counts. Define CGEL_NO_PROFILER to compile every
+// timer and counter out; the API stays, and reports zeros.
+#ifdef CGEL_NO_PROFILER
+    #define CGEL_PROFILE_SCOPE(profiler, stage)
+    #define CGEL_PROFILE_COUNT(profiler, counter, count)
+#else
+    #define CGEL_PROFILE_CONCAT_(a, b) a##b
+    #define CGEL_PROFILE_CONCAT(a, b) CGEL_PROFILE_CONCAT_(a, b)
+    #define CGEL_PROFILE_SCOPE(profiler, stage) ::cgel::ScopedStageTimer CGEL_PROFILE_CONCAT(profileScope, __LINE__)((profiler), (stage))
+    #define CGEL_PROFILE_COUNT(profiler, counter, count) (profiler).addCount((counter), (count))
+#endif
+
+namespace cgel
+{
+    enum ProfileStage
+    {
+        PROFILE_STAGE_TRANSFORM,
+        PROFILE_STAGE_CULL,
+        PROFILE_STAGE_CLIP,
+        PROFILE_STAGE_SORT,
+        PROFILE_STAGE_BIN,
+        PROFILE_STAGE_RASTER,
+        PROFILE_STAGE_PRESENT,
+        PROFILE_STAGE_COUNT
+    };
+
+    enum ProfileCounter
+    {
+        PROFILE_COUNTER_SUBMITTED,
+        PROFILE_COUNTER_BACKFACING,
+        PROFILE_COUNTER_OUTSIDE,
+        PROFILE_COUNTER_CLIPPED,
+        PROFILE_COUNTER_DRAWN,
+        PROFILE_COUNTER_COUNT
+    };
+
+    // Accumulates stage times and counters for the frame in progress. beginFrame() closes the
+    // previous frame, whose numbers are what the getters report, so a frame's figures include
+    // everything up to the next beginFrame(), presentation included.
+    class FrameProfiler
+    {
+        private:
+            uint64_t m_stage_ns[PROFILE_STAGE_COUNT];
+            size_t m_counter[PROFILE_COUNTER_COUNT];
+            uint64_t m_last_stage_ns[PROFILE_STAGE_COUNT];
+            size_t m_last_counter[PROFILE_COUNTER_COUNT];
+
+            std::chrono::steady_clock::time_point m_frame_start;
+            uint64_t m_last_frame_ns;
+
+        public:
+            FrameProfiler() :
+                m_stage_ns{},
+                m_counter{},
+                m_last_stage_ns{},
+                m_last_counter{},
+                m_last_frame_ns(0) {}
+
+            void beginFrame()
+            {
+            #ifndef CGEL_NO_PROFILER
+                const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+                if (m_frame_start != std::chrono::steady_clock::time_point())
+                    m_last_frame_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_frame_start).count();
+                m_frame_start = now;
+
+                for (int i = 0; i < PROFILE_STAGE_COUNT; i++)
+                {
+                    m_last_stage_ns[i] = m_stage_ns[i];
+                    m_stage_ns[i] = 0;
+                }
+                for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+                {
+                    m_last_counter[i] = m_counter[i];
+                    m_counter[i] = 0;
+                }
+            #endif
+            }
+
+            void addTime(const ProfileStage stage, const uint64_t ns) {m_stage_ns[stage] += ns;}
+            void addCount(const ProfileCounter counter, const size_t count) {m_counter[counter] += count;}
+
+            // Figures for the last completed frame.
+            double getStageMilliseconds(const ProfileStage stage) const {return m_last_stage_ns[stage] * 1e-6;}
+            size_t getCounter(const ProfileCounter counter) const {return m_last_counter[counter];}
+
+            // Wall time between the last two beginFrame() calls, including time outside any stage.
+            double getFrameMilliseconds() const {return m_last_frame_ns * 1e-6;}
+
+            static const char *getStageName(const ProfileStage stage)
+            {
+                static const char *const names[PROFILE_STAGE_COUNT] = {"xform", "cull", "clip", "sort", "bin", "raster", "present"};
+                return names[stage];
+            }
+
+            static const char *getCounterName(const ProfileCounter counter)
+            {
+                static const char *const names[PROFILE_COUNTER_COUNT] = {"tris", "back", "out", "clipped", "drawn"};
+                return names[counter];
+            }
+    };
+
+    // Adds the time until the end of the scope to a stage. Use through CGEL_PROFILE_SCOPE.
+    class ScopedStageTimer
+    {
+        private:
+            FrameProfiler &m_profiler;
+            const ProfileStage m_stage;
+            const std::chrono::steady_clock::time_point m_start;
+
+        public:
+            ScopedStageTimer(FrameProfiler &profiler, const ProfileStage stage) :
+                m_profiler(profiler),
+                m_stage(stage),
+                m_start(std::chrono::steady_clock::now()) {}
+
+            ~ScopedStageTimer()
+            {
+                m_profiler.addTime(m_stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+            }
+
+            ScopedStageTimer(const ScopedStageTimer &) = delete;
+            ScopedStageTimer &operator= (const ScopedStageTimer &) = delete;
+    };
+}
+
+#endif
@@ -1,28 +1,159 @@
 #ifndef _GRAPHICS3DENGINE_HPP_
 #define _GRAPHICS3DENGINE_HPP_
 
+#include <unordered_map>
+
 #include "ConsoleGameEngine.hpp"
 #include "Mesh.hpp"
-#include <list>
+#include "WorkerPool.hpp"
+#include "FrameArena.hpp"
+#include "SceneGraph.hpp"
 
 namespace cgel
 {
+    // Order in which the frame's triangles, from every instance together, are handed to the
+    // rasterizer. With the depth buffer on, no sorting is needed; front to back lets the depth
+    // test reject hidden cells early. Back to front is the painter's algorithm for use without
+    // a depth buffer.
+    enum TriangleOrder
+    {
+        TRIANGLE_ORDER_NONE,
+        TRIANGLE_ORDER_FRONT_TO_BACK,
+        TRIANGLE_ORDER_BACK_TO_FRONT
+    };
+
+    // How the frame's triangles are rasterized. Serial draws them one after another on the
+    // calling thread. Tiled bins them into TILE_WIDTH x TILE_HEIGHT screen tiles and draws the
+    // tiles in parallel on the worker pool; tiles never share cells, so no locking is needed.
+    enum RasterMode
+    {
+        RASTER_MODE_SERIAL,
+        RASTER_MODE_TILED
+    };
+
+    // Which clip planes triangles are clipped against. Full clips against the whole view
+    // volume. Guard band only clips against the near and far planes and leaves the screen
+    // edges to the rasterizer's bounding box, which is cheaper when many triangles cross them.
+    // Triangles entirely outside any plane are dropped in both modes.
+    enum ClipMode
+    {
+        CLIP_MODE_FULL,
+        CLIP_MODE_GUARD_BAND
+    };
+
+    // A triangle ready for the rasterizer: screen x, y and depth per vertex.
+    struct RasterTriangle
+    {
+        Vec3f p0;
+        Vec3f p1;
+        Vec3f p2;
+        char asciiChar;
+    };
+
+    // A triangle that survived culling, with the union of its vertices' clip outcodes.
+    struct VisibleTriangle
+    {
+        uint32_t index;
+        unsigned char outcodes;
+        char asciiChar;
+    };
+
+    // A run of a mesh's triangles that survived hierarchical culling, the vertices they use,
+    // and the clip planes their bounds straddle.
+    struct TriangleRange
+    {
+        uint32_t triangleFirst;
+        uint32_t triangleEnd;
+        uint32_t vertexFirst;
+        uint32_t vertexEnd;
+        int planes;
+    };
+
+    // What update() derives from an instance's transform: the inverse that takes the camera
+    // into model space, the rows face normals are transformed to world space by, and world
+    // space bounds. mirrored is set when the transform flips handedness, conformal when it has
+    // no shear or non-uniform scale, so it turns every normal the same way. scale bounds how
+    // much the transform stretches any length.
+    struct InstanceState
+    {
+        Matrix<float, 4, 4> inverseTransform;
+        Vec4f normalRows[3];
+        bool conformal;
+        Vec4f worldBoundsMin;
+        Vec4f worldBoundsMax;
+        Vec4f worldBoundsCentre;
+        float worldBoundsRadius;
+        float scale;
+        bool mirrored;
+        bool dirty;
+    };
+
+    // Every instance of one mesh. The geometry is stored once; an instance is only a transform
+    // from model to world space, and all of a batch's transforms sit in one compact array so
+    // they are refreshed and tested against the view volume together. The model space sphere
+    // is centred on the mesh's bounding box.
+    struct InstanceBatch
+    {
+        MeshHandle mesh;
+        Vec4f boundsCentre;
+        float boundsRadius;
+        std::vector<Matrix<float, 4, 4>> transforms;
+        std::vector<InstanceState> states;
+        std::vector<uint32_t> dirtySlots;
+    };
+
+    struct InstanceLocation
+    {
+        uint32_t batch;
+        uint32_t slot;
+    };
+
     class Graphics3DEngine : public ConsoleGameEngine
     {
+        public:
+            static constexpr long TILE_WIDTH = 32;
+            static constexpr long TILE_HEIGHT = 16;
+
         private:
-            std::vector<Mesh> m_meshCollection;
+            // Instances grouped by mesh, the batch of each mesh, and where each instance id lives.
+            std::vector<InstanceBatch> m_instanceBatches;
+            std::unordered_map<const Mesh *, size_t> m_instanceBatchIndex;
+            std::vector<InstanceLocation> m_instanceLocations;
             const char m_asciiGradient[92] = "`.-':_,^=;><+!rc*/z?sLTv)J7(|Fi{C}fI31tlu[neoZ5Yxjya]2ESwqkP6h9d4VpOGbUAKXHm8RD#$Bg0MNWQ%&@";
             const int m_asciiGradientSize = 92;
 
             // Math :3
             Matrix<float, 4, 4> m_projectionMatrix;
-            Matrix<float, 4, 4> m_worldTransformationMatrix;
             Matrix<float, 4, 4> m_cameraMatrix;
             Matrix<float, 4, 4> m_viewMatrix;
             Matrix<float, 4, 4> m_cameraPitchRotationMatrix;
             Matrix<float, 4, 4> m_cameraYawRotationMatrix;
             Matrix<float, 4, 4> m_cameraFullRotationMatrix;
 
+            // Per-frame clip space positions, reused between meshes and frames.
+            PositionBuffer m_clipPositionBuffer;
+
+            // Transient per-frame buffers all live in m_frameArena, which is reset at the start
+            // of every frame.
+            FrameArena m_frameArena;
+            std::vector<RasterTriangle, ArenaAllocator<RasterTriangle>> m_rasterTriangles;
+            size_t m_lastRasterTriangleCount;
+
+            // The frame's draw list: indices into m_rasterTriangles in the order they are drawn,
+            // or null to draw them in submission order.
+            const uint32_t *m_drawOrder;
+
+            // Tile t's triangles are m_tileTriangleIndices[m_tileTriangleOffsets[t] .. m_tileTriangleOffsets[t + 1]),
+            // indices into m_rasterTriangles in draw order.
+            uint32_t *m_tileTriangleOffsets;
+            uint32_t *m_tileTriangleIndices;
+            long m_tileColumns;
+            long m_tileRows;
+
+            RasterMode m_rasterMode;
+            ClipMode m_clipMode;
+            WorkerPool m_workerPool;
+
             Vec4f m_cameraLookFrom;
             Vec4f m_cameraLookDirection;
             Vec4f m_cameraTarget;
@@ -31,6 +162,11 @@ namespace cgel
             Vec4f m_forward;
             Vec4f m_right;
 
+            TriangleOrder m_triangleOrder;
+
+            // Largest error, in cells, a level of detail may show on screen.
+            float m_lodThreshold;
+
             float m_horizontalFov;
             float m_yaw;
             float m_pitch;
@@ -46,6 +182,423 @@ namespace cgel
             float m_yawRotationSpeed;
             float m_pitchRotationSpeed;
 
+            // Range of tiles covered by a raster triangle's bounding box. False if it is off screen.
+            bool m_getTileRange(const RasterTriangle &tri, long &columnBegin, long &rowBegin, long &columnEnd, long &rowEnd) const
+            {
+                const float xMin = std::min(tri.p0.X(), std::min(tri.p1.X(), tri.p2.X()));
+                const float yMin = std::min(tri.p0.Y(), std::min(tri.p1.Y(), tri.p2.Y()));
+                const float xMax = std::max(tri.p0.X(), std::max(tri.p1.X(), tri.p2.X()));
+                const float yMax = std::max(tri.p0.Y(), std::max(tri.p1.Y(), tri.p2.Y()));
+
+                columnBegin = std::max((long)std::ceil(xMin), 0L) / TILE_WIDTH;
+                rowBegin = std::max((long)std::ceil(yMin), 0L) / TILE_HEIGHT;
+                columnEnd = std::min((long)std::floor(xMax) / TILE_WIDTH, m_tileColumns - 1);
+                rowEnd = std::min((long)std::floor(yMax) / TILE_HEIGHT, m_tileRows - 1);
+                return columnBegin <= columnEnd && rowBegin <= rowEnd && xMax >= 0 && yMax >= 0;
+            }
+
+            // Bin every raster triangle into the tiles its bounding box touches: count per tile,
+            // prefix sum, then fill, all in arena memory.
+            void m_binTriangles()
+            {
+                const size_t tileCount = m_tileColumns * m_tileRows;
+                m_tileTriangleOffsets = m_frameArena.allocateArray<uint32_t>(tileCount + 1);
+                std::fill(m_tileTriangleOffsets, m_tileTriangleOffsets + tileCount + 1, 0);
+
+                long columnBegin, rowBegin, columnEnd, rowEnd;
+                for (const RasterTriangle &tri : m_rasterTriangles)
+                {
+                    if (!m_getTileRange(tri, columnBegin, rowBegin, columnEnd, rowEnd)) continue;
+                    for (long row = rowBegin; row <= rowEnd; row++)
+                        for (long column = columnBegin; column <= columnEnd; column++)
+                            m_tileTriangleOffsets[row * m_tileColumns + column + 1]++;
+                }
+
+                for (size_t t = 0; t < tileCount; t++)
+                    m_tileTriangleOffsets[t + 1] += m_tileTriangleOffsets[t];
+
+                // Fill using the start offsets as cursors, which leaves each at its tile's end,
+                // then shift them back into place.
+                m_tileTriangleIndices = m_frameArena.allocateArray<uint32_t>(m_tileTriangleOffsets[tileCount]);
+                for (size_t n = 0; n < m_rasterTriangles.size(); n++)
+                {
+                    const uint32_t i = m_drawOrder ? m_drawOrder[n] : (uint32_t)n;
+                    if (!m_getTileRange(m_rasterTriangles[i], columnBegin, rowBegin, columnEnd, rowEnd)) continue;
+                    for (long row = rowBegin; row <= rowEnd; row++)
+                        for (long column = columnBegin; column <= columnEnd; column++)
+                            m_tileTriangleIndices[m_tileTriangleOffsets[row * m_tileColumns + column]++] = i;
+                }
+
+                for (size_t t = tileCount; t > 0; t--)
+                    m_tileTriangleOffsets[t] = m_tileTriangleOffsets[t - 1];
+                m_tileTriangleOffsets[0] = 0;
+            }
+
+            // Build the draw list in m_triangleOrder: one 64 bit item per raster triangle, its
+            // depth key above its index, radix sorted on the key. The key is the sum of the
+            // vertex depths, which orders the same as their average, inverted for back to front.
+            void m_sortTriangles()
+            {
+                const size_t count = m_rasterTriangles.size();
+                uint64_t *items = m_frameArena.allocateArray<uint64_t>(count);
+                uint64_t *scratch = m_frameArena.allocateArray<uint64_t>(count);
+                const uint32_t flip = m_triangleOrder == TRIANGLE_ORDER_BACK_TO_FRONT ? 0xFFFFFFFFu : 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    const RasterTriangle &tri = m_rasterTriangles[i];
+                    const uint32_t key = float_sort_key(tri.p0.Z() + tri.p1.Z() + tri.p2.Z()) ^ flip;
+                    items[i] = (uint64_t)key << 32 | i;
+                }
+
+                const uint64_t *sorted = radix_sort_keys(items, scratch, count);
+
+                // The sorted indices go into the other buffer, which is free by now.
+                uint32_t *drawOrder = (uint32_t *)(sorted == items ? scratch : items);
+                for (size_t i = 0; i < count; i++) drawOrder[i] = (uint32_t)sorted[i];
+                m_drawOrder = drawOrder;
+            }
+
+            // Derive an instance's state from its transform. Only the mesh's bounding volumes
+            // are transformed, never its vertices, so this costs the same for any mesh.
+            void m_updateInstance(InstanceBatch &batch, const size_t slot)
+            {
+                const Matrix<float, 4, 4> &transform = batch.transforms[slot];
+                InstanceState &state = batch.states[slot];
+                state.inverseTransform = make_inverse_4x4<float>(transform);
+
+                // Normals go through the cofactor matrix of the linear part, which keeps them
+                // perpendicular to their faces under any invertible transform, scaling included.
+                const Vec4f row0{transform[0][0], transform[0][1], transform[0][2], 0};
+                const Vec4f row1{transform[1][0], transform[1][1], transform[1][2], 0};
+                const Vec4f row2{transform[2][0], transform[2][1], transform[2][2], 0};
+                state.normalRows[0] = row1.crossH(row2);
+                state.normalRows[1] = row2.crossH(row0);
+                state.normalRows[2] = row0.crossH(row1);
+                state.mirrored = row0.dotH(state.normalRows[0]) < 0;
+
+                const float n00 = state.normalRows[0].dotH(state.normalRows[0]);
+                const float tolerance = 1e-5f * n00;
+                state.conformal = std::fabs(state.normalRows[1].dotH(state.normalRows[1]) - n00) <= tolerance &&
+                                  std::fabs(state.normalRows[2].dotH(state.normalRows[2]) - n00) <= tolerance &&
+                                  std::fabs(state.normalRows[0].dotH(state.normalRows[1])) <= tolerance &&
+                                  std::fabs(state.normalRows[0].dotH(state.normalRows[2])) <= tolerance &&
+                                  std::fabs(state.normalRows[1].dotH(state.normalRows[2])) <= tolerance;
+
+                // The world box around the transformed model box: along each world axis, every
+                // model axis contributes whichever end of its extent lands lowest or highest.
+                const Mesh &mesh = *batch.mesh;
+                float minimum[3], maximum[3];
+                for (int j = 0; j < 3; j++)
+                {
+                    minimum[j] = maximum[j] = transform[3][j];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        const float a = mesh.getBoundsMin()[0][i] * transform[i][j];
+                        const float b = mesh.getBoundsMax()[0][i] * transform[i][j];
+                        minimum[j] += std::min(a, b);
+                        maximum[j] += std::max(a, b);
+                    }
+                }
+                state.worldBoundsMin = {minimum[0], minimum[1], minimum[2], 1};
+                state.worldBoundsMax = {maximum[0], maximum[1], maximum[2], 1};
+
+                // The sphere grows by at most the transform's largest singular value. Its square
+                // is bounded by the largest absolute row sum of the rows' Gram matrix, which is
+                // exact for rotations with uniform scaling.
+                const float g00 = row0.dotH(row0), g11 = row1.dotH(row1), g22 = row2.dotH(row2);
+                const float g01 = std::fabs(row0.dotH(row1)), g02 = std::fabs(row0.dotH(row2)), g12 = std::fabs(row1.dotH(row2));
+                const float scale = std::sqrt(std::max(g00 + g01 + g02, std::max(g01 + g11 + g12, g02 + g12 + g22)));
+                state.worldBoundsCentre = batch.boundsCentre * transform;
+                state.worldBoundsRadius = batch.boundsRadius * scale;
+                state.scale = scale;
+                state.dirty = false;
+            }
+
+            // The level of detail to draw a visible instance with: the coarsest whose error, scaled
+            // to world space and projected at the depth of the nearest point of the instance's
+            // bounding sphere, is under m_lodThreshold cells. An instance reaching up to the
+            // camera gets the mesh itself.
+            size_t m_selectLod(const Mesh &mesh, const InstanceState &state) const
+            {
+                const size_t lodCount = mesh.getLodCount();
+                if (lodCount == 1) return 0;
+
+                const float depth = m_cameraLookDirection.dotH(state.worldBoundsCentre.subtractH(m_cameraLookFrom)) - state.worldBoundsRadius;
+                if (depth <= m_zNear) return 0;
+
+                // The projection maps a length at a given depth to the same number of cells
+                // across as down.
+                const float cellsPerModelUnit = state.scale * m_projectionMatrix[1][1] * 0.5f * this->m_screen_height / depth;
+                for (size_t level = lodCount - 1; level > 0; level--)
+                    if (mesh.getLodError(level) * cellsPerModelUnit < m_lodThreshold) return level;
+                return 0;
+            }
+
+            // Walk mesh's bounding volume hierarchy and return the triangle ranges of the leaves
+            // that may be visible, merging neighbours, along with the clip planes each straddles.
+            // Subtrees outside the view volume or facing entirely away from the camera are skipped
+            // and their triangles counted. A mesh without a hierarchy is a single range. The
+            // hierarchy is in model space, so the view volume and camera are passed in model space.
+            TriangleRange *m_cullHierarchy(const Mesh &mesh, const Matrix<float, 4, 4> &modelViewProjectionMatrix, const Vec4f &modelCamera,
+                                           const bool mirrored, const int meshPlanes, size_t &rangeCount, size_t &outsideCount, size_t &backfacingCount)
+            {
+                const ArrayView<BvhNode> nodes = mesh.getBvhNodeCollection();
+                outsideCount = 0;
+                backfacingCount = 0;
+                if (nodes.empty())
+                {
+                    TriangleRange *ranges = m_frameArena.allocateArray<TriangleRange>(1);
+                    ranges[0] = TriangleRange{0, (uint32_t)mesh.getTriangleCount(), 0, (uint32_t)mesh.getVertexCount(), meshPlanes};
+                    rangeCount = 1;
+                    return ranges;
+                }
+
+                Vec4f modelPlanes[CLIP_PLANE_COUNT];
+                extract_frustum_planes(modelViewProjectionMatrix, modelPlanes);
+
+                // A binary tree has at most half its nodes plus one leaves, and the stack of
+                // node and plane mask pairs never holds more than every node.
+                TriangleRange *ranges = m_frameArena.allocateArray<TriangleRange>(nodes.size() / 2 + 1);
+                uint32_t *stack = m_frameArena.allocateArray<uint32_t>(2 * nodes.size());
+                size_t stackSize = 0;
+                stack[stackSize++] = 0;
+                stack[stackSize++] = (uint32_t)meshPlanes;
+                rangeCount = 0;
+                while (stackSize > 0)
+                {
+                    const int parentPlanes = (int)stack[--stackSize];
+                    const uint32_t index = stack[--stackSize];
+                    const BvhNode &node = nodes[index];
+
+                    // Only the planes the parent straddles can cut its children.
+                    int planes = 0;
+                    if (parentPlanes)
+                    {
+                        const Vec4f boxMin{node.boundsMin[0], node.boundsMin[1], node.boundsMin[2], 1};
+                        const Vec4f boxMax{node.boundsMax[0], node.boundsMax[1], node.boundsMax[2], 1};
+                        const Vec4f halfExtent = boxMax.subtractH(boxMin).multiplyH(0.5f);
+                        if (!frustum_test_bounds(modelPlanes, boxMin.addH(halfExtent), std::sqrt(halfExtent.dotH(halfExtent)), boxMin, boxMax, planes, parentPlanes))
+                        {
+                            outsideCount += node.triangleCount;
+                            continue;
+                        }
+                    }
+
+                    if (bvh_node_backfacing(node, modelCamera, mirrored))
+                    {
+                        backfacingCount += node.triangleCount;
+                        continue;
+                    }
+
+                    // Visit the first child first, so ranges come out in triangle order.
+                    if (!node.isLeaf())
+                    {
+                        stack[stackSize++] = node.secondChild;
+                        stack[stackSize++] = (uint32_t)planes;
+                        stack[stackSize++] = index + 1;
+                        stack[stackSize++] = (uint32_t)planes;
+                        continue;
+                    }
+
+                    TriangleRange *last = rangeCount > 0 ? &ranges[rangeCount - 1] : nullptr;
+                    if (last && last->triangleEnd == node.triangleFirst && last->planes == planes)
+                    {
+                        last->triangleEnd += node.triangleCount;
+                        last->vertexFirst = std::min(last->vertexFirst, node.vertexFirst);
+                        last->vertexEnd = std::max(last->vertexEnd, node.vertexEnd);
+                    }
+                    else
+                    {
+                        ranges[rangeCount++] = TriangleRange{node.triangleFirst, node.triangleFirst + node.triangleCount, node.vertexFirst, node.vertexEnd, planes};
+                    }
+                }
+                return ranges;
+            }
+
+            // Run one instance that passed the view volume test through the pipeline: cull its
+            // hierarchy, transform the surviving vertices, cull and shade triangles, then clip,
+            // project and append them to m_rasterTriangles. mesh is the level of detail of the
+            // batch's mesh to draw, and meshPlanes are the planes the instance's bounds straddle.
+            void m_submitInstance(const InstanceBatch &batch, const size_t slot, const Mesh &mesh, const int meshPlanes, const int clipPlanes,
+                                  const Matrix<float, 4, 4> &viewProjectionMatrix)
+            {
+                const InstanceState &state = batch.states[slot];
+                const ArrayView<uint32_t> indexCollection = mesh.getIndexCollection();
+                const size_t triangleCount = mesh.getTriangleCount();
+                const int meshClipPlanes = clipPlanes & meshPlanes;
+                CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_SUBMITTED, triangleCount);
+
+                // Everything up to lighting happens in model space, so the geometry is only read,
+                // never copied per instance. The model matrix is folded into the clip transform,
+                // and the camera is brought into model space instead.
+                const Matrix<float, 4, 4> modelViewProjectionMatrix = batch.transforms[slot] * viewProjectionMatrix;
+                const Vec4f modelCamera = m_cameraLookFrom * state.inverseTransform;
+
+                // First narrow the mesh down to the parts of its hierarchy that may be visible.
+                size_t rangeCount, hiddenOutsideCount, hiddenBackfacingCount;
+                TriangleRange *ranges;
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_CULL);
+                    ranges = m_cullHierarchy(mesh, modelViewProjectionMatrix, modelCamera, state.mirrored, meshPlanes,
+                                             rangeCount, hiddenOutsideCount, hiddenBackfacingCount);
+                }
+
+                // Transform only the vertices of the surviving ranges, once each. Ranges share
+                // vertices, so transform their union. Compressed positions are decoded by the
+                // transform itself.
+                const MeshArrays arrays = mesh.getArrays();
+                const bool compressed = arrays.storage == MESH_STORAGE_COMPRESSED;
+                const PositionStreams &positions = arrays.positions;
+                const QuantizedPositionStreams &quantizedPositions = arrays.quantizedPositions;
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_TRANSFORM);
+                    const Matrix<float, 4, 4> decodeViewProjectionMatrix = compressed ? quantizedPositions.decodeMatrix() * modelViewProjectionMatrix : modelViewProjectionMatrix;
+                    m_clipPositionBuffer.resize(compressed ? quantizedPositions.count : positions.count);
+                    std::pair<uint32_t, uint32_t> *spans = m_frameArena.allocateArray<std::pair<uint32_t, uint32_t>>(rangeCount);
+                    for (size_t r = 0; r < rangeCount; r++) spans[r] = {ranges[r].vertexFirst, ranges[r].vertexEnd};
+                    std::sort(spans, spans + rangeCount);
+
+                    for (size_t r = 0; r < rangeCount;)
+                    {
+                        const uint32_t first = spans[r].first;
+                        uint32_t end = spans[r].second;
+                        for (r++; r < rangeCount && spans[r].first <= end; r++) end = std::max(end, spans[r].second);
+                        if (compressed)
+                            transform_quantized_positions_soa(quantizedPositions.x + first, quantizedPositions.y + first, quantizedPositions.z + first,
+                                                              m_clipPositionBuffer.x() + first, m_clipPositionBuffer.y() + first,
+                                                              m_clipPositionBuffer.z() + first, m_clipPositionBuffer.w() + first,
+                                                              end - first, decodeViewProjectionMatrix);
+                        else
+                            transform_positions_soa(positions.x + first, positions.y + first, positions.z + first, positions.w + first,
+                                                    m_clipPositionBuffer.x() + first, m_clipPositionBuffer.y() + first,
+                                                    m_clipPositionBuffer.z() + first, m_clipPositionBuffer.w() + first,
+                                                    end - first, decodeViewProjectionMatrix);
+                    }
+                }
+
+                // A mirroring transform turns faces inside out, which flips the backface test.
+                const float facingSign = state.mirrored ? -1.0f : 1.0f;
+
+                // Lighting needs world space normals. A conformal transform turns every normal by
+                // the same rotation, so the light can go into model space instead.
+                const bool conformal = state.conformal;
+                const Vec4f normalRow0 = state.normalRows[0], normalRow1 = state.normalRows[1], normalRow2 = state.normalRows[2];
+                const float normalScale = 1 / std::sqrt(state.normalRows[0].dotH(state.normalRows[0]));
+                const Vec4f modelLight{state.normalRows[0].dotH(m_directionalLight) * normalScale,
+                                       state.normalRows[1].dotH(m_directionalLight) * normalScale,
+                                       state.normalRows[2].dotH(m_directionalLight) * normalScale, 0};
+
+                // Drop the surviving triangles that face away or lie entirely outside one clip
+                // plane, and shade the rest. The loop is instantiated once per storage, with
+                // modelPosition(i) and faceNormalAt(t) reading it. Face normals only need to be
+                // unit length for lighting, so faceNormalScale(n) makes up for any that are not.
+                VisibleTriangle *visibleTriangles = m_frameArena.allocateArray<VisibleTriangle>(triangleCount);
+                size_t visibleCount = 0;
+                size_t testedCount = 0;
+                size_t backfacingCount = 0;
+                auto cullTriangles = [&](auto modelPosition, auto faceNormalAt, auto faceNormalScale)
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_CULL);
+                    for (size_t r = 0; r < rangeCount; r++)
+                    {
+                        const int rangePlanes = ranges[r].planes;
+                        testedCount += ranges[r].triangleEnd - ranges[r].triangleFirst;
+                        for (size_t t = ranges[r].triangleFirst; t < ranges[r].triangleEnd; t++)
+                        {
+                            const uint32_t i0 = indexCollection[3 * t + 0];
+                            const uint32_t i1 = indexCollection[3 * t + 1];
+                            const uint32_t i2 = indexCollection[3 * t + 2];
+                            const Vec4f faceNormal = faceNormalAt(t);
+
+                            // Skip triangles facing away from the camera.
+                            if (facingSign * faceNormal.dotH(modelPosition(i0).subtractH(modelCamera)) >= 0) 
+                            {
+                                backfacingCount++;
+                                continue;
+                            }
+
+                            // Trivially reject triangles outside any one plane.
+                            const int outcode0 = clip_outcode(m_clipPositionBuffer.get(i0), rangePlanes);
+                            const int outcode1 = clip_outcode(m_clipPositionBuffer.get(i1), rangePlanes);
+                            const int outcode2 = clip_outcode(m_clipPositionBuffer.get(i2), rangePlanes);
+                            if (outcode0 & outcode1 & outcode2) 
+                                continue;
+
+                            // Light projection.
+                            float lightDP;
+                            if (conformal)
+                            {
+                                lightDP = faceNormal.dotH(modelLight) * faceNormalScale(faceNormal);
+                            }
+                            else
+                            {
+                                Vec4f worldNormal = normalRow0.multiplyH(faceNormal.X()).addH(normalRow1.multiplyH(faceNormal.Y())).addH(normalRow2.multiplyH(faceNormal.Z()));
+                                worldNormal.normalizeH();
+                                lightDP = worldNormal.dotH(m_directionalLight);
+                            }
+
+                            // Index of the gradient array.
+                            unsigned short triangleAsciiGradientIndex = std::max(std::min((int)roundf(lightDP * m_asciiGradientSize), m_asciiGradientSize - 2), 0);
+                            visibleTriangles[visibleCount++] = VisibleTriangle{(uint32_t)t, (unsigned char)(outcode0 | outcode1 | outcode2), m_asciiGradient[triangleAsciiGradientIndex]};
+                        }
+                    }
+                };
+                if (compressed)
+                {
+                    const uint32_t *packedFaceNormals = arrays.packedFaceNormalCollection;
+                    cullTriangles([quantizedPositions](const uint32_t i) {return quantizedPositions.get(i);},
+                                  [packedFaceNormals](const size_t t) {return decode_octahedral_direction(packedFaceNormals[t]);},
+                                  [](const Vec4f &n) {return 1 / std::sqrt(n.dotH(n));});
+                }
+                else
+                {
+                    const Vec4f *faceNormals = arrays.faceNormalCollection;
+                    cullTriangles([positions](const uint32_t i) {return Vec4f{positions.x[i], positions.y[i], positions.z[i], 1};},
+                                  [faceNormals](const size_t t) -> const Vec4f & {return faceNormals[t];},
+                                  [](const Vec4f &) {return 1.0f;});
+                }
+                CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_BACKFACING, hiddenBackfacingCount + backfacingCount);
+                CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_OUTSIDE, hiddenOutsideCount + testedCount - backfacingCount - visibleCount);
+
+                // Then clip what straddles a plane that has to be clipped, and project.
+                size_t clippedCount = 0;
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_CLIP);
+                    for (size_t v = 0; v < visibleCount; v++)
+                    {
+                        const VisibleTriangle &visible = visibleTriangles[v];
+                        ClipPolygon<float> polygon;
+                        polygon.vertex[0] = m_clipPositionBuffer.get(indexCollection[3 * visible.index + 0]);
+                        polygon.vertex[1] = m_clipPositionBuffer.get(indexCollection[3 * visible.index + 1]);
+                        polygon.vertex[2] = m_clipPositionBuffer.get(indexCollection[3 * visible.index + 2]);
+                        polygon.count = 3;
+
+                        if (visible.outcodes & meshClipPlanes)
+                        {
+                            clippedCount++;
+                            if (polygon_clip_homogeneous(polygon, meshClipPlanes) == 0) 
+                                continue;
+                        }
+
+                        // Project to screen space.
+                        Vec3f screen[ClipPolygon<float>::CAPACITY];
+                        for (int i = 0; i < polygon.count; i++)
+                        {
+                            const Vec4f &p = polygon.vertex[i];
+                            const float invW = 1 / p.W();
+                            screen[i] = Vec3f{(p.X() * invW + 1) * 0.5f * this->m_screen_width,
+                                              (p.Y() * invW + 1) * 0.5f * this->m_screen_height,
+                                              p.Z() * invW};
+                        }
+
+                        // The clipped polygon is convex, so fan it into triangles.
+                        for (int i = 1; i + 1 < polygon.count; i++)
+                            m_rasterTriangles.push_back(RasterTriangle{screen[0], screen[i], screen[i + 1], visible.asciiChar});
+                    }
+                }
+                CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_CLIPPED, clippedCount);
+            }
+
             // Keyboard stuff
             void m_handleKeyboardEvents()
             {
@@ -94,9 +647,26 @@ namespace cgel
         
 
         public:
-            Graphics3DEngine(const unsigned width, const unsigned height, const float fov = HALF_PI, const float zNear = 0.01, const float zFar = 100) :
-                ConsoleGameEngine(width, height), 
+            // threadCount is the number of threads rasterizing tiles, including the caller; 0 uses every hardware thread.
+            // A width or height of 0 fits the console, and backend defaults to the platform's console.
+            Graphics3DEngine(const unsigned width, const unsigned height, const float fov = HALF_PI, const float zNear = 0.01, const float zFar = 100, const unsigned threadCount = 0,
+                             std::unique_ptr<ConsoleBackend> backend = nullptr) :
+                ConsoleGameEngine(width, height, std::move(backend)), 
+                m_rasterTriangles(ArenaAllocator<RasterTriangle>(m_frameArena)),
+                m_lastRasterTriangleCount(0),
+                m_drawOrder(nullptr),
+                m_tileTriangleOffsets(nullptr),
+                m_tileTriangleIndices(nullptr),
+                m_tileColumns((m_screen_width + TILE_WIDTH - 1) / TILE_WIDTH),
+                m_tileRows((m_screen_height + TILE_HEIGHT - 1) / TILE_HEIGHT),
+                m_rasterMode(RASTER_MODE_TILED),
+                m_clipMode(CLIP_MODE_FULL),
+                m_workerPool(threadCount),
+                m_triangleOrder(TRIANGLE_ORDER_NONE),
+                m_lodThreshold(0.5f),
                 m_horizontalFov(fov),
+                m_yaw(0),
+                m_pitch(0),
                 m_zNear(zNear),
                 m_zFar(zFar),
                 m_forwardMovementSpeed(0.5),
@@ -114,19 +684,160 @@ namespace cgel
                 m_cameraLookDirection({0, 0, 1, 1}),
                 m_cameraTarget({0, 0, 1, 1}),
                 m_directionalLight({0, 0.45, -1, 1}),
-                m_projectionMatrix(make_projection_4x4<float>(width, height, fov, zNear, zFar)),
-                m_worldTransformationMatrix(make_identity<float, 4>()) {}
+                m_projectionMatrix(make_projection_4x4<float>(m_screen_width, m_screen_height, fov, zNear, zFar)) {}
+
+            void setTriangleOrder(const TriangleOrder triangleOrder) {m_triangleOrder = triangleOrder;}
+            TriangleOrder getTriangleOrder() const {return m_triangleOrder;}
+
+            void setRasterMode(const RasterMode rasterMode) {m_rasterMode = rasterMode;}
+            RasterMode getRasterMode() const {return m_rasterMode;}
+
+            void setClipMode(const ClipMode clipMode) {m_clipMode = clipMode;}
+            ClipMode getClipMode() const {return m_clipMode;}
+
+            // Instances are drawn with the coarsest level of detail of their mesh (see
+            // Mesh::buildLods) whose error stays under threshold cells on screen. 0 always draws
+            // the mesh itself.
+            void setLodThreshold(const float threshold) {m_lodThreshold = threshold;}
+            float getLodThreshold() const {return m_lodThreshold;}
+
+            // The camera sits at position and looks along +z turned by pitch about x, then yaw
+            // about y. The keyboard moves it from there on the next update().
+            void setCamera(const Vec4f &position, const float yaw, const float pitch)
+            {
+                m_cameraLookFrom = position;
+                m_yaw = yaw;
+                m_pitch = pitch;
+            }
+
+            Vec4f getCameraPosition() const {return m_cameraLookFrom;}
+            float getCameraYaw() const {return m_yaw;}
+            float getCameraPitch() const {return m_pitch;}
+
+            // Unit direction the camera looks in for a given yaw and pitch.
+            static Vec4f getCameraLookDirection(const float yaw, const float pitch)
+            {
+                return Vec4f{0, 0, 1, 1}.multiply(make_rotationX_4x4<float>(pitch) * make_rotationY_4x4<float>(yaw));
+            }
+
+            // Where addMesh() places a mesh's centre before the world transform is applied.
+            static Vec4f getMeshOrigin() {return {0, 0, 5.75, 1};}
+
+            // Centre of mesh's bounding box once addMesh() has placed it.
+            static Vec4f getMeshCentre(const Mesh &mesh)
+            {
+                const Vec4f extent = mesh.getBoundsMax().subtractH(mesh.getBoundsMin());
+                return getMeshOrigin().addH(mesh.getBoundsMin().addH(extent.multiplyH(0.5f))).subtractH({0.5, 0.5, 0.5, 0});
+            }
+
+            // Point the camera at mesh's bounding box, as placed by addMesh(), from the given yaw
+            // and pitch and far enough away to see all of it.
+            void setCameraOrbit(const Mesh &mesh, const float yaw, const float pitch)
+            {
+                const Vec4f extent = mesh.getBoundsMax().subtractH(mesh.getBoundsMin());
+                const float radius = 0.75f * std::sqrt(extent.dotH(extent));
+                setCamera(getMeshCentre(mesh).subtractH(getCameraLookDirection(yaw, pitch).multiplyH(radius)), yaw, pitch);
+            }
+
+            // The transform addMesh() gives a mesh: moved so its unit box is centred on the
+            // origin, then transformed, then placed at getMeshOrigin().
+            static Matrix<float, 4, 4> getMeshPlacement(const Matrix<float, 4, 4> &transform)
+            {
+                return make_translation_4x4<float>({-0.5, -0.5, -0.5, 1}) * transform * make_translation_4x4<float>(getMeshOrigin());
+            }
+
+            // Add an instance of mesh drawn with transform, from model to world space. Instances
+            // of one handle share its geometry. Returns the instance's id, which count up from 0.
+            size_t addInstance(MeshHandle mesh, const Matrix<float, 4, 4> &transform = make_identity<float, 4>())
+            {
+                if (!mesh) throw std::runtime_error("Instance of a null mesh.");
+
+                auto found = m_instanceBatchIndex.find(mesh.get());
+                if (found == m_instanceBatchIndex.end())
+                {
+                    // A sphere around the bounding box's centre, usually much tighter than the
+                    // box's own bounding sphere.
+                    const Vec4f centre = mesh->getBoundsMin().addH(mesh->getBoundsMax().subtractH(mesh->getBoundsMin()).multiplyH(0.5f));
+                    const size_t vertexCount = mesh->getVertexCount();
+                    float radiusSquared = 0;
+                    for (size_t i = 0; i < vertexCount; i++)
+                    {
+                        const Vec4f p = mesh->getPosition(i);
+                        const float dx = p.X() - centre.X(), dy = p.Y() - centre.Y(), dz = p.Z() - centre.Z();
+                        radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+                    }
+
+                    found = m_instanceBatchIndex.emplace(mesh.get(), m_instanceBatches.size()).first;
+                    m_instanceBatches.push_back(InstanceBatch{std::move(mesh), centre, std::sqrt(radiusSquared), {}, {}, {}});
+                }
+
+                InstanceBatch &batch = m_instanceBatches[found->second];
+                const uint32_t slot = (uint32_t)batch.transforms.size();
+                batch.transforms.push_back(transform);
+                batch.states.push_back(InstanceState{});
+                batch.states.back().dirty = true;
+                batch.dirtySlots.push_back(slot);
+                m_instanceLocations.push_back(InstanceLocation{(uint32_t)found->second, slot});
+                return m_instanceLocations.size() - 1;
+            }
+
+            // The instance's state is rederived from its new transform on the next update().
+            void setInstanceTransform(const size_t instance, const Matrix<float, 4, 4> &transform)
+            {
+                const InstanceLocation location = m_instanceLocations[instance];
+                InstanceBatch &batch = m_instanceBatches[location.batch];
+                batch.transforms[location.slot] = transform;
+                if (!batch.states[location.slot].dirty)
+                {
+                    batch.states[location.slot].dirty = true;
+                    batch.dirtySlots.push_back(location.slot);
+                }
+            }
+
+            // Set the transforms of instances first to first + count - 1.
+            void setInstanceTransforms(const size_t first, const Matrix<float, 4, 4> *transforms, const size_t count)
+            {
+                for (size_t i = 0; i < count; i++) setInstanceTransform(first + i, transforms[i]);
+            }
+
+            const Matrix<float, 4, 4> &getInstanceTransform(const size_t instance) const
+            {
+                const InstanceLocation location = m_instanceLocations[instance];
+                return m_instanceBatches[location.batch].transforms[location.slot];
+            }
+
+            const MeshHandle &getInstanceMesh(const size_t instance) const {return m_instanceBatches[m_instanceLocations[instance].batch].mesh;}
+            size_t getInstanceCount() const {return m_instanceLocations.size();}
+
+            // A single instance of mesh, placed by getMeshPlacement(transform). Returns its
+            // instance id.
+            size_t addMesh(Mesh mesh, const Matrix<float, 4, 4> &transform = make_identity<float, 4>())
+            {
+                return addInstance(makeMeshHandle(std::move(mesh)), getMeshPlacement(transform));
+            }
 
-            void addMesh(Mesh mesh)
+            // Place an instance as addMesh() does.
+            void setMeshTransform(const size_t instance, const Matrix<float, 4, 4> &transform)
             {
-                m_meshCollection.push_back(mesh);
+                setInstanceTransform(instance, getMeshPlacement(transform));
+            }
+
+            // Bring graph's world transforms up to date and move the instances attached to the
+            // nodes that changed. Call once per frame, before update().
+            void updateSceneGraph(SceneGraph &graph)
+            {
+                graph.update();
+                for (const uint32_t node : graph.getUpdatedNodes())
+                {
+                    const uint32_t instance = graph.getInstance(node);
+                    if (instance != SceneGraph::NO_INSTANCE) setInstanceTransform(instance, graph.getWorldTransform(node));
+                }
             }
 
             // Per frame
             void update()
             {  
-                // Clear screen buffer.
-                clear();
+                m_profiler.beginFrame();
 
                 // Update camera rotation.
                 m_cameraPitchRotationMatrix = make_rotationX_4x4<float>(m_pitch);
@@ -134,169 +845,118 @@ namespace cgel
                 m_cameraFullRotationMatrix = m_cameraPitchRotationMatrix * m_cameraYawRotationMatrix;
                 
                 // Handle keyboard input.
+                pollInput();
                 m_handleKeyboardEvents();
 
                 // Construct the camera and view matrices.
                 m_cameraMatrix = make_pointat_4x4<float>(m_cameraLookFrom, m_cameraTarget, m_up);
                 m_viewMatrix = make_quick_inverse_4x4<float>(m_cameraMatrix);
 
-                for (Mesh &mesh : m_meshCollection)
+                // Vertices go straight from world to clip space. The view space x and y flip that
+                // puts +y up on screen is folded into the projection.
+                const Matrix<float, 4, 4> flipProjectionMatrix = make_scaling_4x4<float>({-1, -1, 1, 1}) * m_projectionMatrix;
+                const Matrix<float, 4, 4> viewProjectionMatrix = m_viewMatrix * flipProjectionMatrix;
+                const int clipPlanes = m_clipMode == CLIP_MODE_GUARD_BAND ? CLIP_PLANES_DEPTH : CLIP_PLANES_ALL;
+                Vec4f frustumPlanes[CLIP_PLANE_COUNT];
+                extract_frustum_planes(viewProjectionMatrix, frustumPlanes);
+
+                // Drop last frame's transient buffers, then size this frame's after last frame's.
+                m_lastRasterTriangleCount = m_rasterTriangles.size();
+                decltype(m_rasterTriangles)(m_rasterTriangles.get_allocator()).swap(m_rasterTriangles);
+                m_frameArena.reset();
+                m_rasterTriangles.reserve(m_lastRasterTriangleCount + m_lastRasterTriangleCount / 4);
+
+                // Build the frame's screen space triangles from every instance, a batch at a time:
+                // refresh the batch's changed instances, test them all against the view volume,
+                // then run the visible ones through the pipeline at their level of detail.
+                for (InstanceBatch &batch : m_instanceBatches)
                 {
-                    // Construct a vector containing the triangles that will be rasterized.
-                    std::vector<Triangle> rasterTriangles;
-                    for (Triangle &tri : mesh.getTriangleCollection()) 
-                    {
-                        Vertex vertex0 = tri.vertex0;
-                        Vertex vertex1 = tri.vertex1;
-                        Vertex vertex2 = tri.vertex2;
-                      
-                        // vertex0
-                        vertex0.position.subtract_assign({0.5, 0.5, 0.5, 0});
-                        vertex0.position.multiply_assign(m_worldTransformationMatrix);
-                        vertex0.position.Z() += 5.75;
-
-                        // vertex1
-                        vertex1.position.subtract_assign({0.5, 0.5, 0.5, 0});
-                        vertex1.position.multiply_assign(m_worldTransformationMatrix);
-                        vertex1.position.Z() += 5.75;
-
-                        // vertex2
-                        vertex2.position.subtract_assign({0.5, 0.5, 0.5, 0});
-                        vertex2.position.multiply_assign(m_worldTransformationMatrix);
-                        vertex2.position.Z() += 5.75;
-
-                        // Get triangle face normal.
-                        Vec4f edge0 = vertex0.position.subtractH(vertex1.position);
-                        Vec4f edge1 = vertex2.position.subtractH(vertex1.position);
-                        Vec4f faceNormal = edge1.crossH(edge0);
-                        faceNormal.normalizeH();
-
-                        // Draw the triangle if it can project onto the camera.
-                        if (faceNormal.dotH(vertex0.position.subtractH(m_cameraLookFrom)) < 0) 
-                        {
-
-                            // Light projection.
-                            const float lightDP = faceNormal.dotH(m_directionalLight);
-
-                            // Index of the gradient array.
-                            unsigned short triangleAsciiGradientIndex = std::max(std::min((int)roundf(lightDP * m_asciiGradientSize), m_asciiGradientSize - 2), 0);
-                            char triangleAsciiChar = m_asciiGradient[triangleAsciiGradientIndex];
-
-                            // Convert to view space.
-                            vertex0.position.multiply_assign(m_viewMatrix);
-                            vertex1.position.multiply_assign(m_viewMatrix);
-                            vertex2.position.multiply_assign(m_viewMatrix);
-                            vertex0.position.mapW();
-                            vertex1.position.mapW();
-                            vertex2.position.mapW();
-
-                            short clippedTriangleCount = 0;
-                            Triangle clippedTriangle[2];
-                            clippedTriangleCount = triangle_clip_against_plane<float>(Vec4f{ 0, 0, 0.1 },
-                                                                                      Vec4f{ 0, 0, 1 },
-                                                                                      Triangle{ vertex0, vertex1, vertex2, faceNormal, triangleAsciiChar }, 
-                                                                                      clippedTriangle[0], clippedTriangle[1]);
-                      
-                            for (uint8_t i = 0; i < clippedTriangleCount; i++) 
-                            {
-        
-                                Vertex clippedVertex0 = clippedTriangle[i].vertex0;
-                                Vertex clippedVertex1 = clippedTriangle[i].vertex1;
-                                Vertex clippedVertex2 = clippedTriangle[i].vertex2;
-                                const char clippedAsciiChar = clippedTriangle[i].asciiChar;
-
-                                // Flip vertices.
-                                clippedVertex0.position.X() *= -1;
-                                clippedVertex0.position.Y() *= -1;
-                                clippedVertex1.position.X() *= -1;
-                                clippedVertex1.position.Y() *= -1;
-                                clippedVertex2.position.X() *= -1;
-                                clippedVertex2.position.Y() *= -1;
-
-                                // Project to 2D space.
-                                clippedVertex0.position.multiply_assign(m_projectionMatrix);
-                                clippedVertex0.position.mapW();
-                                clippedVertex0.position.X()++;
-                                clippedVertex0.position.Y()++;
-                                clippedVertex0.position.X() *= 0.5 * this->m_screen_width;
-                                clippedVertex0.position.Y() *= 0.5 * this->m_screen_height;
-
-                                clippedVertex1.position.multiply_assign(m_projectionMatrix);
-                                clippedVertex1.position.mapW();
-                                clippedVertex1.position.X()++;
-                                clippedVertex1.position.Y()++;
-                                clippedVertex1.position.X() *= 0.5 * this->m_screen_width;
-                                clippedVertex1.position.Y() *= 0.5 * this->m_screen_height;
-
-                                clippedVertex2.position.multiply_assign(m_projectionMatrix);
-                                clippedVertex2.position.mapW();
-                                clippedVertex2.position.X()++;
-                                clippedVertex2.position.Y()++;
-                                clippedVertex2.position.X() *= 0.5 * this->m_screen_width;
-                                clippedVertex2.position.Y() *= 0.5 * this->m_screen_height;
-        
-                                rasterTriangles.push_back(Triangle{clippedVertex0, clippedVertex1, clippedVertex2, faceNormal, clippedAsciiChar});
-                            }
-
-                        }
+                    const Mesh &mesh = *batch.mesh;
+                    const size_t triangleCount = mesh.getTriangleCount();
+                    const size_t instanceCount = batch.transforms.size();
 
+                    if (!batch.dirtySlots.empty())
+                    {
+                        CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_TRANSFORM);
+                        for (const uint32_t slot : batch.dirtySlots) m_updateInstance(batch, slot);
+                        batch.dirtySlots.clear();
                     }
 
+                    if (triangleCount == 0) continue;
 
-                    // Sort triangles from back to front.
-                    std::sort(rasterTriangles.begin(), rasterTriangles.end(), [](Triangle &t1, Triangle &t2)
+                    // Skip instances entirely outside the view volume before any per-vertex work.
+                    // Triangles only need testing and clipping against the planes an instance's
+                    // bounds straddle; an instance entirely inside needs neither.
+                    uint32_t *visibleSlots = m_frameArena.allocateArray<uint32_t>(instanceCount);
+                    int *visiblePlanes = m_frameArena.allocateArray<int>(instanceCount);
+                    size_t visibleInstanceCount = 0;
                     {
-                        float z1 = (t1.vertex0.position.Z() + t1.vertex1.position.Z() + t1.vertex2.position.Z()) / 3.0f;
-                        float z2 = (t2.vertex0.position.Z() + t2.vertex1.position.Z() + t2.vertex2.position.Z()) / 3.0f;
-                        return z1 > z2;
-                    });
+                        CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_CULL);
+                        for (size_t slot = 0; slot < instanceCount; slot++)
+                        {
+                            const InstanceState &state = batch.states[slot];
+                            int planes;
+                            if (!frustum_test_bounds(frustumPlanes, state.worldBoundsCentre, state.worldBoundsRadius, state.worldBoundsMin, state.worldBoundsMax, planes))
+                                continue;
+                            visibleSlots[visibleInstanceCount] = (uint32_t)slot;
+                            visiblePlanes[visibleInstanceCount++] = planes;
+                        }
+                    }
+                    // Visible instances count their triangles at the level of detail they are drawn with.
+                    CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_SUBMITTED, triangleCount * (instanceCount - visibleInstanceCount));
+                    CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_OUTSIDE, triangleCount * (instanceCount - visibleInstanceCount));
 
-                    // Clip the triangles against the edges of the screen.
-                    for (auto &&tri : rasterTriangles) 
+                    for (size_t i = 0; i < visibleInstanceCount; i++)
                     {
-                        Triangle clippedTriangle[2];
-                        std::list<Triangle> triangleList;
-
-                        triangleList.push_back(tri);
-                        uint8_t newTriangles = 1;
-
-                        for (uint8_t i = 0; i < 4; i++) {
+                        const InstanceState &state = batch.states[visibleSlots[i]];
+                        m_submitInstance(batch, visibleSlots[i], mesh.getLod(m_selectLod(mesh, state)), visiblePlanes[i], clipPlanes, viewProjectionMatrix);
+                    }
+                }
 
-                            uint8_t trianglesToAdd = 0;
-                            while(newTriangles > 0) {
+                CGEL_PROFILE_COUNT(m_profiler, PROFILE_COUNTER_DRAWN, m_rasterTriangles.size());
 
-                                Triangle testTriangle = triangleList.front();
-                                triangleList.pop_front();
-                                newTriangles--;
+                // Optionally sort the frame's triangles by their average depth.
+                m_drawOrder = nullptr;
+                if (m_triangleOrder != TRIANGLE_ORDER_NONE)
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_SORT);
+                    m_sortTriangles();
+                }
 
-                                switch(i) {
-                                    case 0:	trianglesToAdd = triangle_clip_against_plane<float>({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, testTriangle, clippedTriangle[0], clippedTriangle[1]); break;
-                                    case 1:	trianglesToAdd = triangle_clip_against_plane<float>({ 0.0f, (float)this->m_screen_height - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, testTriangle, clippedTriangle[0], clippedTriangle[1]); break;
-                                    case 2:	trianglesToAdd = triangle_clip_against_plane<float>({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, testTriangle, clippedTriangle[0], clippedTriangle[1]); break;
-                                    case 3:	trianglesToAdd = triangle_clip_against_plane<float>({ (float)this->m_screen_width - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, testTriangle, clippedTriangle[0], clippedTriangle[1]); break;
-                                }
+                // Draw each triangle.
+                if (m_rasterMode == RASTER_MODE_TILED)
+                {
+                    {
+                        CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_BIN);
+                        m_binTriangles();
+                    }
 
-                                for (uint8_t j = 0; j < trianglesToAdd; j++) {
-                                    triangleList.push_back(clippedTriangle[j]);
-                                }
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_RASTER);
 
-                            }
-                            newTriangles = triangleList.size();
-                        }
+                    // Each tile clears and draws only its own cells.
+                    m_workerPool.parallelFor((size_t)(m_tileColumns * m_tileRows), [this](const size_t tile)
+                    {
+                        const long left = (long)(tile % m_tileColumns) * TILE_WIDTH;
+                        const long top = (long)(tile / m_tileColumns) * TILE_HEIGHT;
+                        const ScreenRect scissor{left, top, std::min(left + TILE_WIDTH, (long)m_screen_width) - 1, std::min(top + TILE_HEIGHT, (long)m_screen_height) - 1};
 
-                        // Draw each triangle.
-                        for (auto &&tri : triangleList) 
+                        clear(scissor);
+                        for (uint32_t i = m_tileTriangleOffsets[tile]; i < m_tileTriangleOffsets[tile + 1]; i++)
                         {
-                            const Vec2f p0{tri.vertex0.position.X(), tri.vertex0.position.Y()};
-                            const Vec2f p1{tri.vertex1.position.X(), tri.vertex1.position.Y()};
-                            const Vec2f p2{tri.vertex2.position.X(), tri.vertex2.position.Y()};
-                            drawTriangle(p0, p1, p2, tri.asciiChar);
+                            const RasterTriangle &tri = m_rasterTriangles[m_tileTriangleIndices[i]];
+                            drawTriangle(tri.p0, tri.p1, tri.p2, tri.asciiChar, scissor);
                         }
-
-
+                    });
+                }
+                else
+                {
+                    CGEL_PROFILE_SCOPE(m_profiler, PROFILE_STAGE_RASTER);
+                    clear();
+                    for (size_t n = 0; n < m_rasterTriangles.size(); n++)
+                    {
+                        const RasterTriangle &tri = m_rasterTriangles[m_drawOrder ? m_drawOrder[n] : n];
+                        drawTriangle(tri.p0, tri.p1, tri.p2, tri.asciiChar);
                     }
-                    
-
                 }
             }
     };
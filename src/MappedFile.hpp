@@ -0,0 +1,111 @@
+#ifndef _MAPPED_FILE_HPP_
+#define _MAPPED_FILE_HPP_
+
+#include <string>
+#include <stdexcept>
+#include <cstddef>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+namespace cgel
+{
+    // Read-only view of a whole file mapped into memory.
+    class MappedFile
+    {
+        private:
+            const char *m_data;
+            size_t m_size;
+
+        #ifdef _WIN32
+            HANDLE m_file_handle;
+            HANDLE m_mapping_handle;
+        #endif
+
+            void m_close()
+            {
+            #ifdef _WIN32
+                if (m_data) UnmapViewOfFile(m_data);
+                if (m_mapping_handle) CloseHandle(m_mapping_handle);
+                if (m_file_handle != INVALID_HANDLE_VALUE) CloseHandle(m_file_handle);
+                m_mapping_handle = NULL;
+                m_file_handle = INVALID_HANDLE_VALUE;
+            #else
+                if (m_data) munmap((void *)m_data, m_size);
+            #endif
+                m_data = nullptr;
+                m_size = 0;
+            }
+
+        public:
+            explicit MappedFile(const std::string &fileName) :
+                m_data(nullptr),
+                m_size(0)
+            #ifdef _WIN32
+                , m_file_handle(INVALID_HANDLE_VALUE),
+                m_mapping_handle(NULL)
+            #endif
+            {
+            #ifdef _WIN32
+                m_file_handle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+                if (m_file_handle == INVALID_HANDLE_VALUE)
+                    throw std::runtime_error(fileName + " not found.");
+
+                LARGE_INTEGER fileSize;
+                GetFileSizeEx(m_file_handle, &fileSize);
+                m_size = (size_t)fileSize.QuadPart;
+
+                // Empty files cannot be mapped, leave the view empty.
+                if (m_size == 0) return;
+
+                m_mapping_handle = CreateFileMappingA(m_file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (m_mapping_handle) m_data = (const char *)MapViewOfFile(m_mapping_handle, FILE_MAP_READ, 0, 0, 0);
+            #else
+                const int fd = open(fileName.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error(fileName + " not found.");
+
+                struct stat fileStat;
+                if (fstat(fd, &fileStat) == 0) m_size = (size_t)fileStat.st_size;
+
+                if (m_size == 0)
+                {
+                    close(fd);
+                    return;
+                }
+
+                void *view = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd);
+                if (view != MAP_FAILED)
+                {
+                    m_data = (const char *)view;
+                    madvise(view, m_size, MADV_SEQUENTIAL);
+                }
+            #endif
+
+                if (!m_data)
+                {
+                    m_close();
+                    throw std::runtime_error(fileName + " could not be mapped.");
+                }
+            }
+
+            ~MappedFile() {m_close();}
+
+            MappedFile(const MappedFile &) = delete;
+            MappedFile &operator= (const MappedFile &) = delete;
+
+            const char *data() const {return m_data;}
+            size_t size() const {return m_size;}
+            const char *begin() const {return m_data;}
+            const char *end() const {return m_data + m_size;}
+    };
+}
+
+#endif
@@ -3,6 +3,19 @@
 
 #include <cstddef>
 #include <cmath>
+#include <type_traits>
+
+// SSE is used for Vec4f and 4x4 float matrices unless CGEL_NO_SIMD is defined.
+#if !defined(CGEL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+    #define CGEL_SSE
+    #include <emmintrin.h>
+#endif
+
+// Wider 8 lane paths (vertex transform, rasterizer) additionally need AVX to be enabled.
+#if !defined(CGEL_NO_SIMD) && defined(__AVX__)
+    #define CGEL_AVX
+    #include <immintrin.h>
+#endif
 
 namespace cgel {
 
@@ -26,6 +39,8 @@ namespace cgel {
                         m_data[i][j] = 0;
             }
 
+            Matrix(const Matrix &t) = default;
+
             Matrix<Type, Cols, Rows> T() const {
                 Matrix<Type, Cols, Rows> trans;
                 for (size_t i = 0; i < Rows; i++)
@@ -984,6 +999,456 @@ namespace cgel {
             
     };
 
+
+#ifdef CGEL_SSE
+
+    // SSE specializations of the hot float types. Storage is 16 byte aligned and the
+    // public interface matches the generic templates above.
+
+    template<>
+    class Matrix<float, 4, 4> {
+
+        protected:
+            alignas(16) float m_data[4][4];
+
+            __m128 m_row(const size_t i) const {return _mm_load_ps(m_data[i]);}
+
+        public:
+
+            Matrix() {
+                const __m128 zero = _mm_setzero_ps();
+                for (size_t i = 0; i < 4; i++)
+                    _mm_store_ps(m_data[i], zero);
+            }
+
+            Matrix(const Matrix &t) = default;
+
+            Matrix<float, 4, 4> T() const {
+                Matrix trans(*this);
+                __m128 r0 = trans.m_row(0), r1 = trans.m_row(1), r2 = trans.m_row(2), r3 = trans.m_row(3);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_store_ps(trans.m_data[0], r0);
+                _mm_store_ps(trans.m_data[1], r1);
+                _mm_store_ps(trans.m_data[2], r2);
+                _mm_store_ps(trans.m_data[3], r3);
+                return trans;
+            }
+
+            Matrix<float, 4, 4> transposed() const {
+                return T();
+            }
+
+
+            float *operator[](const size_t i) {return m_data[i];}
+            const float *operator[](const size_t i) const {return m_data[i];}
+
+
+            Matrix &operator= (const Matrix &t) = default;
+
+
+            Matrix operator+ (const Matrix &t) const {
+                Matrix add;
+                for (size_t i = 0; i < 4; i++)
+                    _mm_store_ps(add.m_data[i], _mm_add_ps(m_row(i), t.m_row(i)));
+                return add;
+            }
+
+            Matrix operator- (const Matrix &t) const {
+                Matrix sub;
+                for (size_t i = 0; i < 4; i++)
+                    _mm_store_ps(sub.m_data[i], _mm_sub_ps(m_row(i), t.m_row(i)));
+                return sub;
+            }
+
+            Matrix operator* (const float s) const {
+                Matrix scale;
+                const __m128 scalar = _mm_set1_ps(s);
+                for (size_t i = 0; i < 4; i++)
+                    _mm_store_ps(scale.m_data[i], _mm_mul_ps(m_row(i), scalar));
+                return scale;
+            }
+
+            friend Matrix operator* (const float s, const Matrix &t) {
+                return t * s;
+            }
+
+            Matrix operator/ (const float s) const {
+                Matrix scale;
+                const __m128 scalar = _mm_set1_ps(s);
+                for (size_t i = 0; i < 4; i++)
+                    _mm_store_ps(scale.m_data[i], _mm_div_ps(m_row(i), scalar));
+                return scale;
+            }
+
+            Matrix &operator+=(const Matrix &t) {
+                return *this = *this + t;
+            }
+
+            Matrix &operator-=(const Matrix &t) {
+                return *this = *this - t;
+            }
+
+            Matrix &operator*=(const float t) {
+                return *this = *this * t;
+            }
+
+            Matrix &operator/=(const float t) {
+                return *this = *this / t;
+            }
+
+            // * Matrix multiplication method *
+            // Each row of the product is a weighted sum of the rows of t.
+            Matrix operator* (const Matrix &t) const {
+                Matrix mul;
+                const __m128 t0 = t.m_row(0), t1 = t.m_row(1), t2 = t.m_row(2), t3 = t.m_row(3);
+                for (size_t i = 0; i < 4; i++) {
+                    __m128 row = _mm_mul_ps(_mm_set1_ps(m_data[i][0]), t0);
+                    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m_data[i][1]), t1));
+                    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m_data[i][2]), t2));
+                    row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(m_data[i][3]), t3));
+                    _mm_store_ps(mul.m_data[i], row);
+                }
+                return mul;
+            }
+
+            template<size_t R, size_t C, std::enable_if_t<(4 == R && 4 != C)> * = nullptr>
+            Matrix<float, 4, C> operator* (const Matrix<float, R, C> &t) const {
+                Matrix<float, 4, C> mul;
+                for (size_t i = 0; i < 4; i++) {
+                    for (size_t j = 0; j < C; j++) {
+                        mul[i][j] = 0;
+                        for (size_t k = 0; k < 4; k++) 
+                            mul[i][j] += m_data[i][k] * t[k][j];
+                    }
+                }
+                return mul;
+            }
+
+
+
+            Matrix &assign(const Matrix &t) {
+                return *this = t;
+            }
+
+
+            Matrix add(const Matrix &t) const {
+                return *this + t;
+            }
+
+            Matrix subtract(const Matrix &t) const {
+                return *this - t;
+            }
+
+            Matrix multiply(const float s) const {
+                return *this * s;
+            }
+
+            friend Matrix multiply(const float s, const Matrix &t) {
+                return t * s;
+            }
+
+            Matrix divide(const float s) const {
+                return *this / s;
+            }
+
+            Matrix &add_assign(const Matrix &t) {
+                return *this = *this + t;
+            }
+
+            Matrix &subtract_assign(const Matrix &t) {
+                return *this = *this - t;
+            }
+
+            Matrix &multiply_assign(const float t) {
+                return *this = *this * t;
+            }
+
+            Matrix &divide_assign(const float t) {
+                return *this = *this / t;
+            }
+
+            // * Matrix multiplication method *
+            template<size_t R, size_t C, std::enable_if_t<(4 == R)> * = nullptr>
+            Matrix<float, 4, C> multiply(const Matrix<float, R, C> &t) const {
+                return *this * t;
+            }
+    };
+
+
+
+
+    // 4D Vec (1x4 Matrix/Tensor)
+    // * H methods treat the Vec4D as homogenous *
+    template<>
+    class Matrix<float, 1, 4> {
+
+        private:
+            alignas(16) float m_data[1][4];
+
+            __m128 m_load() const {return _mm_load_ps(m_data[0]);}
+            void m_store(const __m128 v) {_mm_store_ps(m_data[0], v);}
+
+            static Matrix m_from(const __m128 v) {
+                Matrix m;
+                m.m_store(v);
+                return m;
+            }
+
+            // Lanes x, y and z of a, lane w of b.
+            static __m128 m_select_xyz(const __m128 a, const __m128 b) {
+                const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+                return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+            }
+
+            static __m128 m_dot3(const __m128 a, const __m128 b) {
+                const __m128 mul = _mm_mul_ps(a, b);
+                const __m128 y = _mm_shuffle_ps(mul, mul, _MM_SHUFFLE(1, 1, 1, 1));
+                const __m128 z = _mm_shuffle_ps(mul, mul, _MM_SHUFFLE(2, 2, 2, 2));
+                return _mm_add_ss(_mm_add_ss(mul, y), z);
+            }
+
+        public:
+
+            Matrix() {
+                m_store(_mm_setzero_ps());
+            }
+
+            Matrix(const float x, const float y, const float z) {
+                m_store(_mm_setr_ps(x, y, z, 1));
+            }
+
+            Matrix(const float x, const float y, const float z, const float w) {
+                m_store(_mm_setr_ps(x, y, z, w));
+            }
+
+            Matrix(const Matrix<float, 1, 4> &t) = default;
+
+            float *operator[](const size_t i) {return m_data[i];}
+            const float *operator[](const size_t i) const {return m_data[i];}
+
+            float &X() {return this->m_data[0][0];}
+            float X() const {return this->m_data[0][0];}
+            float &Y() {return this->m_data[0][1];}
+            float Y() const {return this->m_data[0][1];}
+            float &Z() {return this->m_data[0][2];}
+            float Z() const {return this->m_data[0][2];}
+            float &W() {return this->m_data[0][3];}
+            float W() const {return this->m_data[0][3];}
+
+            Matrix &operator= (const Matrix &t) = default;
+
+            Matrix operator+ (const Matrix &t) const {
+                return m_from(_mm_add_ps(m_load(), t.m_load()));
+            }
+
+            Matrix operator- (const Matrix &t) const {
+                return m_from(_mm_sub_ps(m_load(), t.m_load()));
+            }
+
+            Matrix operator* (const float s) const {
+                return m_from(_mm_mul_ps(m_load(), _mm_set1_ps(s)));
+            }
+
+            friend Matrix operator* (const float s, const Matrix &t) {
+                return t * s;
+            }
+
+            Matrix operator/ (const float s) const {
+                return m_from(_mm_div_ps(m_load(), _mm_set1_ps(s)));
+            }
+
+            Matrix &operator+=(const Matrix &t) {
+                return *this = *this + t;
+            }
+
+            Matrix &operator-=(const Matrix &t) {
+                return *this = *this - t;
+            }
+
+            Matrix &operator*=(const float t) {
+                return *this = *this * t;
+            }
+
+            Matrix &operator/=(const float t) {
+                return *this = *this / t;
+            }
+
+            // * Matrix multiplication method *
+            // The product is a weighted sum of the rows of t.
+            Matrix operator* (const Matrix<float, 4, 4> &t) const {
+                __m128 mul = _mm_mul_ps(_mm_set1_ps(m_data[0][0]), _mm_load_ps(t[0]));
+                mul = _mm_add_ps(mul, _mm_mul_ps(_mm_set1_ps(m_data[0][1]), _mm_load_ps(t[1])));
+                mul = _mm_add_ps(mul, _mm_mul_ps(_mm_set1_ps(m_data[0][2]), _mm_load_ps(t[2])));
+                mul = _mm_add_ps(mul, _mm_mul_ps(_mm_set1_ps(m_data[0][3]), _mm_load_ps(t[3])));
+                return m_from(mul);
+            }
+
+            template<size_t R, size_t C, std::enable_if_t<(4 == R && 4 != C)> * = nullptr>
+            Matrix<float, 1, C> operator* (const Matrix<float, R, C> &t) const {
+                Matrix<float, 1, C> mul;
+                for (size_t j = 0; j < C; j++) {
+                    mul[0][j] = 0;
+                    for (size_t k = 0; k < 4; k++) 
+                        mul[0][j] += m_data[0][k] * t[k][j];
+                }
+                return mul;
+            }
+
+            Matrix operator*=(const Matrix<float, 4, 4> &t) {
+                return *this = *this * t;
+            }
+
+            Matrix &assign (const Matrix &t) {
+                return *this = t;
+            }
+
+            Matrix add (const Matrix &t) const {
+                return *this + t;
+            }
+
+            Matrix subtract (const Matrix &t) const {
+                return *this - t;
+            }
+
+            Matrix multiply (const float s) const {
+                return *this * s;
+            }
+
+            Matrix divide (const float s) const {
+                return *this / s;
+            }
+
+            Matrix &add_assign(const Matrix &t) {
+                return *this = *this + t;
+            }
+
+            Matrix &subtract_assign(const Matrix &t) {
+                return *this = *this - t;
+            }
+
+            Matrix &multiply_assign(const float t) {
+                return *this = *this * t;
+            }
+
+            Matrix &divide_assign(const float t) {
+                return *this = *this / t;
+            }
+
+            // * Matrix multiplication method *
+            template<size_t R, size_t C, std::enable_if_t<(4 == R)> * = nullptr>
+            Matrix<float, 1, C> multiply (const Matrix<float, R, C> &t) const {
+                return *this * t;
+            }
+
+            Matrix multiply_assign(const Matrix<float, 4, 4> &t) {
+                return *this = *this * t;
+            }
+
+            Matrix addH(const Matrix &t) const {
+                const __m128 v = m_load();
+                return m_from(m_select_xyz(_mm_add_ps(v, t.m_load()), v));
+            }
+
+            Matrix subtractH(const Matrix &t) const {
+                const __m128 v = m_load();
+                return m_from(m_select_xyz(_mm_sub_ps(v, t.m_load()), v));
+            }
+
+            Matrix multiplyH(const float s) const {
+                const __m128 v = m_load();
+                return m_from(m_select_xyz(_mm_mul_ps(v, _mm_set1_ps(s)), v));
+            }
+
+            friend Matrix multiplyH(const float s, const Matrix &t) {
+                return t.multiplyH(s);
+            }
+
+            Matrix divideH(const float s) const {
+                const __m128 v = m_load();
+                return m_from(m_select_xyz(_mm_div_ps(v, _mm_set1_ps(s)), v));
+            }
+
+            Matrix &addH_assign(const Matrix &t) {
+                return *this = addH(t);
+            }
+
+            Matrix &subtractH_assign(const Matrix &t) {
+                return *this = subtractH(t);
+            }
+
+            Matrix &multiplyH_assign(const float s) {
+                return *this = multiplyH(s);
+            }
+
+            Matrix &divideH_assign(const float s) {
+                return *this = divideH(s);
+            }
+
+
+
+            Matrix<float, 4, 1> T() const {
+                Matrix<float, 4, 1> trans;
+                for (size_t j = 0; j < 4; j++)
+                    trans[j][0] = m_data[0][j];
+                return trans;
+            }
+
+            Matrix<float, 4, 1> transposed() const {
+                return T();
+            }
+
+            Matrix &mapW() {
+                return *this = mappedW();
+            }
+
+            Matrix mappedW() const {
+                const __m128 v = m_load();
+                const __m128 w = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+                return m_from(m_select_xyz(_mm_div_ps(v, w), _mm_set1_ps(1)));
+            }
+
+            float dotH(const Matrix &v) const {
+                return _mm_cvtss_f32(m_dot3(m_load(), v.m_load()));
+            }
+
+            Matrix crossH(const Matrix &v) const {
+                const __m128 a = m_load();
+                const __m128 b = v.m_load();
+                const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+                const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+                const __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+                return m_from(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+            }
+
+            float normH() const {
+                return _mm_cvtss_f32(_mm_sqrt_ss(m_dot3(m_load(), m_load())));
+            }
+
+            float normH(const Matrix &v) const {
+                const __m128 d = _mm_sub_ps(m_load(), v.m_load());
+                return _mm_cvtss_f32(_mm_sqrt_ss(m_dot3(d, d)));
+            }
+
+            Matrix &normalizeH() {
+                const __m128 v = m_load();
+                const __m128 dot = m_dot3(v, v);
+                const __m128 norm = _mm_sqrt_ps(_mm_shuffle_ps(dot, dot, _MM_SHUFFLE(0, 0, 0, 0)));
+                m_store(m_select_xyz(_mm_div_ps(v, norm), v));
+                return *this;
+            }
+
+            Matrix unitH() const {
+                const __m128 v = m_load();
+                const __m128 dot = m_dot3(v, v);
+                const __m128 norm = _mm_sqrt_ps(_mm_shuffle_ps(dot, dot, _MM_SHUFFLE(0, 0, 0, 0)));
+                return m_from(m_select_xyz(_mm_div_ps(v, norm), _mm_set1_ps(1)));
+            }
+
+            
+    };
+
+#endif
+
     // Type definitions
     template<typename Type> using Vec2 = Matrix<Type, 1, 2>;
     template<typename Type> using Vec3 = Matrix<Type, 1, 3>;
@@ -1104,12 +1569,13 @@ namespace cgel {
         return m;
     }
 
+    // Vectors are rows (v * M), so the translation goes in the bottom row.
     template<typename Type>
     Matrix<Type, 4, 4> make_translation_4x4(const Matrix<Type, 1, 4> &t) {
         Matrix<Type, 4, 4> m = make_identity<Type, 4>();
-        m[0][3] = t[0][0];
-        m[1][3] = t[0][1];
-        m[2][3] = t[0][2];
+        m[3][0] = t[0][0];
+        m[3][1] = t[0][1];
+        m[3][2] = t[0][2];
         return m;
     }
 
@@ -1165,6 +1631,46 @@ namespace cgel {
         return m;
     }
 
+    // Inverse of any invertible matrix, by cofactor expansion. make_quick_inverse_4x4 is
+    // cheaper when t is a rotation plus a translation.
+    template<typename Type>
+    Matrix<Type, 4, 4> make_inverse_4x4(const Matrix<Type, 4, 4> &t) {
+        // 2x2 minors of the top two and bottom two rows.
+        const Type a0 = t[0][0] * t[1][1] - t[0][1] * t[1][0];
+        const Type a1 = t[0][0] * t[1][2] - t[0][2] * t[1][0];
+        const Type a2 = t[0][0] * t[1][3] - t[0][3] * t[1][0];
+        const Type a3 = t[0][1] * t[1][2] - t[0][2] * t[1][1];
+        const Type a4 = t[0][1] * t[1][3] - t[0][3] * t[1][1];
+        const Type a5 = t[0][2] * t[1][3] - t[0][3] * t[1][2];
+        const Type b0 = t[2][0] * t[3][1] - t[2][1] * t[3][0];
+        const Type b1 = t[2][0] * t[3][2] - t[2][2] * t[3][0];
+        const Type b2 = t[2][0] * t[3][3] - t[2][3] * t[3][0];
+        const Type b3 = t[2][1] * t[3][2] - t[2][2] * t[3][1];
+        const Type b4 = t[2][1] * t[3][3] - t[2][3] * t[3][1];
+        const Type b5 = t[2][2] * t[3][3] - t[2][3] * t[3][2];
+
+        const Type inv_det = 1 / (a0 * b5 - a1 * b4 + a2 * b3 + a3 * b2 - a4 * b1 + a5 * b0);
+
+        Matrix<Type, 4, 4> m;
+        m[0][0] = ( t[1][1] * b5 - t[1][2] * b4 + t[1][3] * b3) * inv_det;
+        m[0][1] = (-t[0][1] * b5 + t[0][2] * b4 - t[0][3] * b3) * inv_det;
+        m[0][2] = ( t[3][1] * a5 - t[3][2] * a4 + t[3][3] * a3) * inv_det;
+        m[0][3] = (-t[2][1] * a5 + t[2][2] * a4 - t[2][3] * a3) * inv_det;
+        m[1][0] = (-t[1][0] * b5 + t[1][2] * b2 - t[1][3] * b1) * inv_det;
+        m[1][1] = ( t[0][0] * b5 - t[0][2] * b2 + t[0][3] * b1) * inv_det;
+        m[1][2] = (-t[3][0] * a5 + t[3][2] * a2 - t[3][3] * a1) * inv_det;
+        m[1][3] = ( t[2][0] * a5 - t[2][2] * a2 + t[2][3] * a1) * inv_det;
+        m[2][0] = ( t[1][0] * b4 - t[1][1] * b2 + t[1][3] * b0) * inv_det;
+        m[2][1] = (-t[0][0] * b4 + t[0][1] * b2 - t[0][3] * b0) * inv_det;
+        m[2][2] = ( t[3][0] * a4 - t[3][1] * a2 + t[3][3] * a0) * inv_det;
+        m[2][3] = (-t[2][0] * a4 + t[2][1] * a2 - t[2][3] * a0) * inv_det;
+        m[3][0] = (-t[1][0] * b3 + t[1][1] * b1 - t[1][2] * b0) * inv_det;
+        m[3][1] = ( t[0][0] * b3 - t[0][1] * b1 + t[0][2] * b0) * inv_det;
+        m[3][2] = (-t[3][0] * a3 + t[3][1] * a1 - t[3][2] * a0) * inv_det;
+        m[3][3] = ( t[2][0] * a3 - t[2][1] * a1 + t[2][2] * a0) * inv_det;
+        return m;
+    }
+
 
 }
 
@@ -2,14 +2,22 @@
 #define _MESH_HPP_
 
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <string>
-#include <sstream>
 #include <stdexcept>
-#include <strstream>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <memory>
 
 #include "MathUtil.hpp"
+#include "MappedFile.hpp"
+#include "VertexBatch.hpp"
+#include "MeshBvh.hpp"
+#include "MeshLod.hpp"
 
 namespace cgel 
 {
@@ -33,121 +41,905 @@ namespace cgel
         char asciiChar;
     };
 
+    // Read-only window over contiguous elements owned elsewhere.
+    template<typename Type>
+    class ArrayView
+    {
+        private:
+            const Type *m_data;
+            size_t m_size;
+
+        public:
+            ArrayView(const Type *data, const size_t size) : m_data(data), m_size(size) {}
+
+            const Type &operator[](const size_t i) const {return m_data[i];}
+            const Type *data() const {return m_data;}
+            size_t size() const {return m_size;}
+            bool empty() const {return m_size == 0;}
+            const Type *begin() const {return m_data;}
+            const Type *end() const {return m_data + m_size;}
+    };
+
+    // How a mesh keeps its vertices. Full stores float positions, texture coordinates and
+    // normals, 44 bytes a vertex plus a 16 byte face normal per triangle. Compressed stores
+    // positions quantized to 16 bits across the bounding box, normals and face normals
+    // octahedrally encoded in 32 bits and texture coordinates as two half floats: 14 bytes a
+    // vertex and 4 per face normal. Indices and the hierarchy are the same in both.
+    enum MeshStorage
+    {
+        MESH_STORAGE_FULL,
+        MESH_STORAGE_COMPRESSED
+    };
+
+    // Raw arrays of a mesh, wherever they are stored. Only the arrays of the mesh's storage
+    // are set; the others are empty.
+    struct MeshArrays
+    {
+        PositionStreams positions;
+        const Vec3f *textureCoordinateCollection;
+        const Vec4f *normalCollection;
+        const uint32_t *indexCollection;
+        const Vec4f *faceNormalCollection;
+        size_t triangleCount;
+        const BvhNode *bvhNodeCollection;
+        size_t bvhNodeCount;
+
+        MeshStorage storage;
+        QuantizedPositionStreams quantizedPositions;
+        const uint32_t *packedTextureCoordinateCollection;
+        const uint32_t *packedNormalCollection;
+        const uint32_t *packedFaceNormalCollection;
+    };
+
+    // Indexed triangle mesh: unique vertices, three indices per triangle and a face normal
+    // per triangle. Vertex positions are kept as separate x/y/z/w arrays for the batch
+    // transform in VertexBatch.hpp; texture coordinates and normals are kept alongside.
+    // The arrays either live in the mesh itself or in a mapped cache file (see MeshCache.hpp).
+    // A mesh may also carry a bounding volume hierarchy over its triangles (see MeshBvh.hpp),
+    // which is dropped as soon as the mesh is modified, and a chain of simplified levels of
+    // detail, which are too. compress() switches it to compressed storage (see MeshStorage),
+    // and modifying it switches it back.
     class Mesh
     {
         private:
-            std::vector<Triangle> m_triangle_collection;
+            PositionBuffer m_position_collection;
+            std::vector<Vec3f> m_texture_coordinate_collection;
+            std::vector<Vec4f> m_normal_collection;
+            std::vector<uint32_t> m_index_collection;
+            std::vector<Vec4f> m_face_normal_collection;
+            std::vector<BvhNode> m_bvh_node_collection;
+
+            // Compressed storage, in place of the float arrays above. Texture coordinates hold
+            // u in the low half and v in the high half.
+            MeshStorage m_storage;
+            std::vector<uint16_t> m_quantized_x;
+            std::vector<uint16_t> m_quantized_y;
+            std::vector<uint16_t> m_quantized_z;
+            Vec4f m_quantization_scale;
+            Vec4f m_quantization_offset;
+            std::vector<uint32_t> m_packed_texture_coordinate_collection;
+            std::vector<uint32_t> m_packed_normal_collection;
+            std::vector<uint32_t> m_packed_face_normal_collection;
+
+            // Set when the arrays live in a mapped file rather than the vectors above.
+            std::shared_ptr<const MappedFile> m_mapping;
+            MeshArrays m_mapped_arrays;
+
+            Vec4f m_bounds_min;
+            Vec4f m_bounds_max;
+
+            // Levels of detail 1 and up, coarsest last, and their errors.
+            std::vector<Mesh> m_lod_collection;
+            std::vector<float> m_lod_error_collection;
+
+            void m_reset_bounds()
+            {
+                m_bounds_min = {INFINITY, INFINITY, INFINITY, 1};
+                m_bounds_max = {-INFINITY, -INFINITY, -INFINITY, 1};
+            }
+
+            void m_include_in_bounds(const Vec4f &p)
+            {
+                m_bounds_min.X() = std::min(m_bounds_min.X(), p.X());
+                m_bounds_min.Y() = std::min(m_bounds_min.Y(), p.Y());
+                m_bounds_min.Z() = std::min(m_bounds_min.Z(), p.Z());
+                m_bounds_max.X() = std::max(m_bounds_max.X(), p.X());
+                m_bounds_max.Y() = std::max(m_bounds_max.Y(), p.Y());
+                m_bounds_max.Z() = std::max(m_bounds_max.Z(), p.Z());
+            }
+
+            // Copy mapped arrays into the mesh, in whichever storage they are in.
+            void m_detach()
+            {
+                if (!m_mapping) return;
+                const MeshArrays arrays = m_mapped_arrays;
+                m_storage = arrays.storage;
+                if (m_storage == MESH_STORAGE_COMPRESSED)
+                {
+                    const QuantizedPositionStreams &positions = arrays.quantizedPositions;
+                    m_quantized_x.assign(positions.x, positions.x + positions.count);
+                    m_quantized_y.assign(positions.y, positions.y + positions.count);
+                    m_quantized_z.assign(positions.z, positions.z + positions.count);
+                    m_quantization_scale = positions.scale;
+                    m_quantization_offset = positions.offset;
+                    m_packed_texture_coordinate_collection.assign(arrays.packedTextureCoordinateCollection, arrays.packedTextureCoordinateCollection + positions.count);
+                    m_packed_normal_collection.assign(arrays.packedNormalCollection, arrays.packedNormalCollection + positions.count);
+                    m_packed_face_normal_collection.assign(arrays.packedFaceNormalCollection, arrays.packedFaceNormalCollection + arrays.triangleCount);
+                }
+                else
+                {
+                    const size_t vertexCount = arrays.positions.count;
+                    m_position_collection.resize(vertexCount);
+                    std::copy(arrays.positions.x, arrays.positions.x + vertexCount, m_position_collection.x());
+                    std::copy(arrays.positions.y, arrays.positions.y + vertexCount, m_position_collection.y());
+                    std::copy(arrays.positions.z, arrays.positions.z + vertexCount, m_position_collection.z());
+                    std::copy(arrays.positions.w, arrays.positions.w + vertexCount, m_position_collection.w());
+                    m_texture_coordinate_collection.assign(arrays.textureCoordinateCollection, arrays.textureCoordinateCollection + vertexCount);
+                    m_normal_collection.assign(arrays.normalCollection, arrays.normalCollection + vertexCount);
+                    m_face_normal_collection.assign(arrays.faceNormalCollection, arrays.faceNormalCollection + arrays.triangleCount);
+                }
+                m_index_collection.assign(arrays.indexCollection, arrays.indexCollection + 3 * arrays.triangleCount);
+                m_bvh_node_collection.assign(arrays.bvhNodeCollection, arrays.bvhNodeCollection + arrays.bvhNodeCount);
+                m_mapping.reset();
+            }
+
+            // Bring the mesh into its own full storage before it gets modified.
+            void m_make_editable()
+            {
+                m_detach();
+                if (m_storage == MESH_STORAGE_FULL) return;
+
+                const size_t vertexCount = m_quantized_x.size();
+                m_position_collection.resize(vertexCount);
+                m_texture_coordinate_collection.resize(vertexCount);
+                m_normal_collection.resize(vertexCount);
+                m_face_normal_collection.resize(m_packed_face_normal_collection.size());
+                for (size_t i = 0; i < vertexCount; i++)
+                {
+                    const Vertex vertex = getVertex(i);
+                    m_position_collection.set(i, vertex.position);
+                    m_texture_coordinate_collection[i].assign(vertex.textureCoordinate);
+                    m_normal_collection[i].assign(vertex.normal);
+                }
+                for (size_t t = 0; t < m_face_normal_collection.size(); t++)
+                    m_face_normal_collection[t].assign(getFaceNormal(t));
+
+                std::vector<uint16_t>().swap(m_quantized_x);
+                std::vector<uint16_t>().swap(m_quantized_y);
+                std::vector<uint16_t>().swap(m_quantized_z);
+                std::vector<uint32_t>().swap(m_packed_texture_coordinate_collection);
+                std::vector<uint32_t>().swap(m_packed_normal_collection);
+                std::vector<uint32_t>().swap(m_packed_face_normal_collection);
+                m_storage = MESH_STORAGE_FULL;
+            }
 
         public:
+            Mesh() :
+                m_storage(MESH_STORAGE_FULL),
+                m_quantization_scale(1, 1, 1, 0),
+                m_quantization_offset(0, 0, 0, 1),
+                m_mapped_arrays{} {m_reset_bounds();}
+
+            Mesh(PositionBuffer positionCollection,
+                 std::vector<Vec3f> textureCoordinateCollection,
+                 std::vector<Vec4f> normalCollection,
+                 std::vector<uint32_t> indexCollection,
+                 std::vector<Vec4f> faceNormalCollection) : Mesh()
+            {
+                m_position_collection = std::move(positionCollection);
+                m_texture_coordinate_collection = std::move(textureCoordinateCollection);
+                m_normal_collection = std::move(normalCollection);
+                m_index_collection = std::move(indexCollection);
+                m_face_normal_collection = std::move(faceNormalCollection);
+                for (size_t i = 0; i < m_position_collection.size(); i++)
+                    m_include_in_bounds(m_position_collection.get(i));
+            }
+
+            // View arrays that live inside mapping; the mesh keeps the mapping alive.
+            Mesh(std::shared_ptr<const MappedFile> mapping, const MeshArrays &arrays, const Vec4f &boundsMin, const Vec4f &boundsMax) :
+                m_storage(arrays.storage),
+                m_quantization_scale(arrays.quantizedPositions.scale),
+                m_quantization_offset(arrays.quantizedPositions.offset),
+                m_mapping(std::move(mapping)),
+                m_mapped_arrays(arrays),
+                m_bounds_min(boundsMin),
+                m_bounds_max(boundsMax) {}
+
+            uint32_t addVertex(const Vertex &vertex)
+            {
+                m_make_editable();
+                m_bvh_node_collection.clear();
+                clearLods();
+                m_position_collection.push_back(vertex.position);
+                m_texture_coordinate_collection.push_back(vertex.textureCoordinate);
+                m_normal_collection.push_back(vertex.normal);
+                m_include_in_bounds(vertex.position);
+                return (uint32_t)m_position_collection.size() - 1;
+            }
+
+            void addTriangle(const uint32_t i0, const uint32_t i1, const uint32_t i2)
+            {
+                m_make_editable();
+                m_bvh_node_collection.clear();
+                clearLods();
+                const Vec4f p0 = m_position_collection.get(i0);
+                const Vec4f U(m_position_collection.get(i1).subtractH(p0));
+                const Vec4f V(m_position_collection.get(i2).subtractH(p0));
+                m_index_collection.push_back(i0);
+                m_index_collection.push_back(i1);
+                m_index_collection.push_back(i2);
+                m_face_normal_collection.push_back(U.crossH(V).unitH());
+            }
+
+            // Appends the triangle's vertices as they are, without welding.
             void addTriangle(const Triangle &tri) 
             {
-                m_triangle_collection.push_back(tri);
+                const uint32_t i0 = addVertex(tri.vertex0);
+                const uint32_t i1 = addVertex(tri.vertex1);
+                const uint32_t i2 = addVertex(tri.vertex2);
+                m_index_collection.push_back(i0);
+                m_index_collection.push_back(i1);
+                m_index_collection.push_back(i2);
+                m_face_normal_collection.push_back(tri.faceNormal);
             }
 
-            std::vector<Triangle> &getTriangleCollection() 
+            bool isMapped() const {return m_mapping != nullptr;}
+
+            MeshArrays getArrays() const
             {
-                return m_triangle_collection;
+                if (m_mapping) return m_mapped_arrays;
+                return MeshArrays{m_position_collection.streams(),
+                                  m_texture_coordinate_collection.data(),
+                                  m_normal_collection.data(),
+                                  m_index_collection.data(),
+                                  m_face_normal_collection.data(),
+                                  m_index_collection.size() / 3,
+                                  m_bvh_node_collection.data(),
+                                  m_bvh_node_collection.size(),
+                                  m_storage,
+                                  QuantizedPositionStreams{m_quantized_x.data(), m_quantized_y.data(), m_quantized_z.data(), m_quantized_x.size(),
+                                                           m_quantization_scale, m_quantization_offset},
+                                  m_packed_texture_coordinate_collection.data(),
+                                  m_packed_normal_collection.data(),
+                                  m_packed_face_normal_collection.data()};
             }
-    };
 
-    // https://stackoverflow.com/questions/52824956/how-can-i-parse-a-simple-obj-file-into-triangles
-    Mesh constructMeshFromObjectFile(const std::string &fileName)
-    {
-        std::ifstream objectFile(fileName);
-        if (!objectFile.is_open())
-            throw std::runtime_error(fileName + "not found.");
+            MeshStorage getStorage() const {return getArrays().storage;}
 
-        std::vector<Vec4f> vertexPositionCollection;
-        std::vector<Vec3f> vertexTextureCoordinateCollection;
-        std::vector<Vec4f> vertexNormalCollection;
-        std::vector<Vertex> vertexCollection;
-        Mesh mesh;
+            // Switch to compressed storage (see MeshStorage). Positions are first snapped to the
+            // 16 bit grid and the hierarchy, if there is one, rebuilt around them, so culling stays
+            // exact for the geometry actually drawn. The w of texture coordinates is dropped.
+            // Throws if a position's w is not 1. Levels of detail are compressed along with it.
+            void compress()
+            {
+                for (Mesh &lod : m_lod_collection) lod.compress();
+                if (getStorage() == MESH_STORAGE_COMPRESSED) return;
+                m_detach();
 
-        std::string lineString;
-        while(std::getline(objectFile, lineString))
-        {
-            std::istringstream lineStream(lineString);
-            std::string lineType;
-            lineStream >> lineType;
+                const size_t vertexCount = m_position_collection.size();
+                for (size_t i = 0; i < vertexCount; i++)
+                    if (m_position_collection.w()[i] != 1) throw std::runtime_error("Only meshes with w = 1 can be compressed.");
+
+                // 65535 steps across the bounding box on each axis.
+                Vec4f scale{0, 0, 0, 1};
+                Vec4f offset{0, 0, 0, 1};
+                if (vertexCount > 0)
+                {
+                    offset = m_bounds_min;
+                    for (int k = 0; k < 3; k++) scale[0][k] = (m_bounds_max[0][k] - m_bounds_min[0][k]) / 65535;
+                }
+                auto quantize = [&scale, &offset](const float value, const int k)
+                {
+                    return scale[0][k] > 0 ? (uint16_t)std::min(std::max(std::lround((value - offset[0][k]) / scale[0][k]), 0L), 65535L) : (uint16_t)0;
+                };
+
+                m_reset_bounds();
+                for (size_t i = 0; i < vertexCount; i++)
+                {
+                    // The same arithmetic as QuantizedPositionStreams::get(), so the snapped
+                    // positions are exactly the decoded ones.
+                    const Vec4f p = m_position_collection.get(i);
+                    const Vec4f snappedPosition{quantize(p.X(), 0) * scale.X() + offset.X(),
+                                                quantize(p.Y(), 1) * scale.Y() + offset.Y(),
+                                                quantize(p.Z(), 2) * scale.Z() + offset.Z(), 1};
+                    m_position_collection.set(i, snappedPosition);
+                    m_include_in_bounds(snappedPosition);
+                }
+                for (Vec4f &faceNormal : m_face_normal_collection)
+                    faceNormal.assign(decode_octahedral(encode_octahedral(faceNormal)));
+                if (!m_bvh_node_collection.empty()) buildBvh();
+
+                m_quantized_x.resize(vertexCount);
+                m_quantized_y.resize(vertexCount);
+                m_quantized_z.resize(vertexCount);
+                m_packed_texture_coordinate_collection.resize(vertexCount);
+                m_packed_normal_collection.resize(vertexCount);
+                for (size_t i = 0; i < vertexCount; i++)
+                {
+                    const Vec4f p = m_position_collection.get(i);
+                    m_quantized_x[i] = quantize(p.X(), 0);
+                    m_quantized_y[i] = quantize(p.Y(), 1);
+                    m_quantized_z[i] = quantize(p.Z(), 2);
+                    const Vec3f &textureCoordinate = m_texture_coordinate_collection[i];
+                    m_packed_texture_coordinate_collection[i] = (uint32_t)float_to_half(textureCoordinate[0][0]) | (uint32_t)float_to_half(textureCoordinate[0][1]) << 16;
+                    m_packed_normal_collection[i] = encode_octahedral(m_normal_collection[i]);
+                }
+                m_packed_face_normal_collection.resize(m_face_normal_collection.size());
+                for (size_t t = 0; t < m_face_normal_collection.size(); t++)
+                    m_packed_face_normal_collection[t] = encode_octahedral(m_face_normal_collection[t]);
+                m_quantization_scale = scale;
+                m_quantization_offset = offset;
+
+                m_position_collection = PositionBuffer();
+                std::vector<Vec3f>().swap(m_texture_coordinate_collection);
+                std::vector<Vec4f>().swap(m_normal_collection);
+                std::vector<Vec4f>().swap(m_face_normal_collection);
+                m_storage = MESH_STORAGE_COMPRESSED;
+            }
+
+            // Sort the triangles into a bounding volume hierarchy, then renumber the vertices in
+            // order of first use so every node's vertices sit close together.
+            void buildBvh()
+            {
+                m_make_editable();
+                m_bvh_node_collection = build_mesh_bvh(m_position_collection.streams(), m_index_collection, m_face_normal_collection);
+
+                const size_t vertexCount = m_position_collection.size();
+                std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+                std::vector<uint32_t> order;
+                order.reserve(vertexCount);
+                for (uint32_t &index : m_index_collection)
+                {
+                    if (remap[index] == UINT32_MAX)
+                    {
+                        remap[index] = (uint32_t)order.size();
+                        order.push_back(index);
+                    }
+                    index = remap[index];
+                }
+                // Unreferenced vertices go last.
+                for (uint32_t i = 0; i < vertexCount; i++)
+                    if (remap[i] == UINT32_MAX) order.push_back(i);
+
+                PositionBuffer positionCollection;
+                std::vector<Vec3f> textureCoordinateCollection(vertexCount);
+                std::vector<Vec4f> normalCollection(vertexCount);
+                positionCollection.resize(vertexCount);
+                for (size_t i = 0; i < vertexCount; i++)
+                {
+                    positionCollection.set(i, m_position_collection.get(order[i]));
+                    textureCoordinateCollection[i].assign(m_texture_coordinate_collection[order[i]]);
+                    normalCollection[i].assign(m_normal_collection[order[i]]);
+                }
+                m_position_collection = std::move(positionCollection);
+                m_texture_coordinate_collection.swap(textureCoordinateCollection);
+                m_normal_collection.swap(normalCollection);
+
+                bvh_compute_vertex_ranges(m_bvh_node_collection, m_index_collection);
+            }
+
+            // Replace the levels of detail with a chain simplified from this mesh (see
+            // build_mesh_lods), each a mesh of its own with its hierarchy built and in this
+            // mesh's storage. Only positions and face normals are kept faithful: vertices that
+            // shared a position are merged into the first of them, texture coordinate and
+            // normal included.
+            void buildLods(const size_t minTriangleCount = MESH_LOD_MIN_TRIANGLES)
+            {
+                clearLods();
+                const size_t vertexCount = getVertexCount();
+                PositionBuffer positionCollection;
+                positionCollection.resize(vertexCount);
+                for (size_t i = 0; i < vertexCount; i++) positionCollection.set(i, getPosition(i));
 
-            if (lineType == "v")
+                const std::vector<MeshLodLevel> levels = build_mesh_lods(positionCollection.streams(), getIndexCollection().data(), getTriangleCount(), minTriangleCount);
+                std::vector<uint32_t> remap(vertexCount);
+                for (const MeshLodLevel &level : levels)
+                {
+                    Mesh lod;
+                    std::fill(remap.begin(), remap.end(), UINT32_MAX);
+                    for (size_t i = 0; i < level.indexCollection.size(); i += 3)
+                    {
+                        uint32_t triangle[3];
+                        for (int k = 0; k < 3; k++)
+                        {
+                            const uint32_t index = level.indexCollection[i + k];
+                            if (remap[index] == UINT32_MAX) remap[index] = lod.addVertex(getVertex(index));
+                            triangle[k] = remap[index];
+                        }
+                        lod.addTriangle(triangle[0], triangle[1], triangle[2]);
+                    }
+                    lod.buildBvh();
+                    if (getStorage() == MESH_STORAGE_COMPRESSED) lod.compress();
+                    addLod(std::move(lod), level.error);
+                }
+            }
+
+            // Append a level of detail to draw in place of this mesh when error, how far it
+            // strays from this mesh in model units, is too small to see. Levels go coarsest
+            // last, with errors that never decrease.
+            void addLod(Mesh lod, const float error)
+            {
+                m_lod_collection.push_back(std::move(lod));
+                m_lod_error_collection.push_back(error);
+            }
+
+            void clearLods()
             {
-                float x = 0;
-                float y = 0;
-                float z = 0;
-                float w = 1;
-                lineStream >> x >> y >> z >> w;
-                vertexPositionCollection.push_back(Vec4f{x, y, z, w});
+                m_lod_collection.clear();
+                m_lod_error_collection.clear();
             }
 
-            else if (lineType == "vt")
+            // Level 0 is the mesh itself, with an error of 0.
+            size_t getLodCount() const {return m_lod_collection.size() + 1;}
+            const Mesh &getLod(const size_t level) const {return level == 0 ? *this : m_lod_collection[level - 1];}
+            float getLodError(const size_t level) const {return level == 0 ? 0 : m_lod_error_collection[level - 1];}
+
+            size_t getVertexCount() const
             {
-                float u = 0;
-                float v = 0;
-                float w = 0;
-                lineStream >> u >> v >> w;
-                vertexTextureCoordinateCollection.push_back(Vec3f{u, v, w});
+                const MeshArrays arrays = getArrays();
+                return arrays.storage == MESH_STORAGE_COMPRESSED ? arrays.quantizedPositions.count : arrays.positions.count;
             }
 
-            else if (lineType == "vn")
+            size_t getTriangleCount() const {return getArrays().triangleCount;}
+
+            // The arrays of full storage, empty when the mesh is compressed.
+            PositionStreams getPositionStreams() const {return getArrays().positions;}
+            ArrayView<Vec3f> getTextureCoordinateCollection() const {return {getArrays().textureCoordinateCollection, getArrays().positions.count};}
+            ArrayView<Vec4f> getNormalCollection() const {return {getArrays().normalCollection, getArrays().positions.count};}
+            ArrayView<Vec4f> getFaceNormalCollection() const {return {getArrays().faceNormalCollection, getStorage() == MESH_STORAGE_FULL ? getTriangleCount() : 0};}
+
+            // The arrays of compressed storage, empty when the mesh is not.
+            QuantizedPositionStreams getQuantizedPositionStreams() const {return getArrays().quantizedPositions;}
+            ArrayView<uint32_t> getPackedTextureCoordinateCollection() const {return {getArrays().packedTextureCoordinateCollection, getArrays().quantizedPositions.count};}
+            ArrayView<uint32_t> getPackedNormalCollection() const {return {getArrays().packedNormalCollection, getArrays().quantizedPositions.count};}
+            ArrayView<uint32_t> getPackedFaceNormalCollection() const {return {getArrays().packedFaceNormalCollection, getStorage() == MESH_STORAGE_COMPRESSED ? getTriangleCount() : 0};}
+
+            ArrayView<uint32_t> getIndexCollection() const {return {getArrays().indexCollection, 3 * getTriangleCount()};}
+            ArrayView<BvhNode> getBvhNodeCollection() const {return {getArrays().bvhNodeCollection, getArrays().bvhNodeCount};}
+
+            // Axis-aligned bounds of the vertex positions. Min is greater than max when empty.
+            const Vec4f &getBoundsMin() const {return m_bounds_min;}
+            const Vec4f &getBoundsMax() const {return m_bounds_max;}
+
+            // Vertices and face normals in either storage, decoded if compressed.
+            Vec4f getPosition(const size_t i) const
             {
-                float i = 0; 
-                float j = 0; 
-                float k = 0;
-                lineStream >> i >> j >> k;
-                vertexNormalCollection.push_back(Vec4f{i, j, k, 1}.unitH());
+                const MeshArrays arrays = getArrays();
+                if (arrays.storage == MESH_STORAGE_COMPRESSED) return arrays.quantizedPositions.get(i);
+                return Vec4f{arrays.positions.x[i], arrays.positions.y[i], arrays.positions.z[i], arrays.positions.w[i]};
             }
 
-            if( lineType == "f" )
+            Vertex getVertex(const size_t i) const
             {
-                std::vector<VertexRef> vertexRefCollection;
-                std::string refString;
-                while(lineStream >> refString)
+                const MeshArrays arrays = getArrays();
+                if (arrays.storage == MESH_STORAGE_COMPRESSED)
                 {
-                    std::istringstream ref(refString);
-                    std::string vString, vtString, vnString;
+                    const uint32_t textureCoordinate = arrays.packedTextureCoordinateCollection[i];
+                    return Vertex{arrays.quantizedPositions.get(i),
+                                  Vec3f{half_to_float((uint16_t)(textureCoordinate & 0xFFFF)), half_to_float((uint16_t)(textureCoordinate >> 16)), 0},
+                                  decode_octahedral(arrays.packedNormalCollection[i])};
+                }
+                return Vertex{getPosition(i), arrays.textureCoordinateCollection[i], arrays.normalCollection[i]};
+            }
+
+            Vec4f getFaceNormal(const size_t i) const
+            {
+                const MeshArrays arrays = getArrays();
+                if (arrays.storage == MESH_STORAGE_COMPRESSED) return decode_octahedral(arrays.packedFaceNormalCollection[i]);
+                return arrays.faceNormalCollection[i];
+            }
 
-                    std::getline( ref, vString, '/' );
-                    std::getline( ref, vtString, '/' );
-                    std::getline( ref, vnString, '/' );
+            // Expands triangle i into a standalone Triangle.
+            Triangle getTriangle(const size_t i) const
+            {
+                const MeshArrays arrays = getArrays();
+                return Triangle{getVertex(arrays.indexCollection[3 * i + 0]),
+                                getVertex(arrays.indexCollection[3 * i + 1]),
+                                getVertex(arrays.indexCollection[3 * i + 2]),
+                                getFaceNormal(i),
+                                ' '};
+            }
+    };
 
-                    int v  = atoi( vString.c_str());
-                    int vt = atoi(vtString.c_str());
-                    int vn = atoi(vnString.c_str());
+    // Shared, immutable mesh. Every instance made from one handle (see
+    // Graphics3DEngine::addInstance) draws the same copy of the geometry.
+    using MeshHandle = std::shared_ptr<const Mesh>;
 
-                    v  = ( v >= 0 ?  v : vertexPositionCollection.size() + v);
-                    vt = (vt >= 0 ? vt : vertexTextureCoordinateCollection.size() + vt);
-                    vn = (vn >= 0 ? vn : vertexNormalCollection.size() + vn );
-                    vertexRefCollection.push_back( VertexRef{ v - 1, vt - 1, vn - 1 } );
+    inline MeshHandle makeMeshHandle(Mesh mesh)
+    {
+        return std::make_shared<const Mesh>(std::move(mesh));
+    }
+
+    namespace detail
+    {
+        inline bool is_obj_space(const char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        inline const char *skip_obj_spaces(const char *first, const char *last)
+        {
+            while (first != last && is_obj_space(*first)) first++;
+            return first;
+        }
+
+        // Parse one float in place, leaving value untouched if the field is missing.
+        inline const char *parse_obj_float(const char *first, const char *last, float &value)
+        {
+            first = skip_obj_spaces(first, last);
+            if (first != last && *first == '+') first++;
+            const std::from_chars_result result = std::from_chars(first, last, value);
+            return result.ptr;
+        }
+
+        // Parse one "v", "v/vt", "v//vn" or "v/vt/vn" reference. Missing fields are left as 0.
+        inline const char *parse_obj_vertex_ref(const char *first, const char *last, VertexRef &ref)
+        {
+            ref = VertexRef{0, 0, 0};
+            int32_t *fields[3] = {&ref.v, &ref.vt, &ref.vn};
+            for (int i = 0; i < 3; i++)
+            {
+                if (first != last && *first == '+') first++;
+                first = std::from_chars(first, last, *fields[i]).ptr;
+                if (first == last || *first != '/') break;
+                first++;
+            }
+            while (first != last && !is_obj_space(*first)) first++;
+            return first;
+        }
+
+        // Convert a 1-based or negative (relative) OBJ index into a 0-based one, -1 if absent.
+        // count is the number of elements declared before the face, across the whole file.
+        inline int32_t resolve_obj_index(const int32_t index, const size_t count)
+        {
+            if (index > 0) return index - 1;
+            if (index < 0) return (int32_t)count + index;
+            return -1;
+        }
+
+        inline bool operator== (const VertexRef &a, const VertexRef &b)
+        {
+            return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+        }
+
+        // Open-addressing map from v/vt/vn tuples to vertex ids, used to weld shared vertices.
+        class VertexRefWelder
+        {
+            private:
+                std::vector<VertexRef> m_ref_collection;
+                std::vector<uint32_t> m_slots;
+                size_t m_mask;
+
+                static size_t m_hash(const VertexRef &ref)
+                {
+                    uint64_t h = (uint32_t)ref.v * 0x9E3779B97F4A7C15ull;
+                    h ^= (uint32_t)ref.vt * 0xC2B2AE3D27D4EB4Full + (h >> 29);
+                    h ^= (uint32_t)ref.vn * 0x165667B19E3779F9ull + (h >> 32);
+                    return (size_t)(h ^ (h >> 31));
+                }
+
+                void m_rehash(const size_t capacity)
+                {
+                    m_slots.assign(capacity, UINT32_MAX);
+                    m_mask = capacity - 1;
+                    for (uint32_t id = 0; id < m_ref_collection.size(); id++)
+                    {
+                        size_t slot = m_hash(m_ref_collection[id]) & m_mask;
+                        while (m_slots[slot] != UINT32_MAX) slot = (slot + 1) & m_mask;
+                        m_slots[slot] = id;
+                    }
+                }
+
+            public:
+                VertexRefWelder() : m_slots(64, UINT32_MAX), m_mask(63) {}
+
+                // Returns the id of ref, giving it the next free id if it is new.
+                uint32_t weld(const VertexRef &ref)
+                {
+                    size_t slot = m_hash(ref) & m_mask;
+                    while (m_slots[slot] != UINT32_MAX)
+                    {
+                        if (m_ref_collection[m_slots[slot]] == ref) return m_slots[slot];
+                        slot = (slot + 1) & m_mask;
+                    }
+
+                    const uint32_t id = (uint32_t)m_ref_collection.size();
+                    m_ref_collection.push_back(ref);
+                    m_slots[slot] = id;
+                    if (2 * m_ref_collection.size() > m_slots.size()) m_rehash(2 * m_slots.size());
+                    return id;
                 }
 
-                for( size_t i = 1; i+1 < vertexRefCollection.size(); ++i )
+                const std::vector<VertexRef> &getRefCollection() const {return m_ref_collection;}
+        };
+
+        // A face as seen by one chunk. Element counts are local to the chunk so negative
+        // references can be resolved once the counts of the preceding chunks are known.
+        struct ObjectFileFace
+        {
+            uint32_t firstRef, refCount;
+            uint32_t vCount, vtCount, vnCount;
+        };
+
+        // Everything parsed out of one line-aligned slice of an OBJ file.
+        struct ObjectFileChunk
+        {
+            const char *begin;
+            const char *end;
+
+            std::vector<Vec4f> vertexPositionCollection;
+            std::vector<Vec3f> vertexTextureCoordinateCollection;
+            std::vector<Vec4f> vertexNormalCollection;
+            std::vector<VertexRef> vertexRefCollection;
+            std::vector<ObjectFileFace> faceCollection;
+
+            // Offsets of this chunk's elements in the file-wide collections.
+            size_t vBase, vtBase, vnBase;
+
+            // Triangles over chunk-local vertex ids, welded within the chunk.
+            VertexRefWelder welder;
+            std::vector<uint32_t> indexCollection;
+        };
+
+        inline void parse_obj_chunk(ObjectFileChunk &chunk)
+        {
+            const char *cursor = chunk.begin;
+            const char *const chunkEnd = chunk.end;
+            while (cursor != chunkEnd)
+            {
+                const char *lineEnd = (const char *)std::memchr(cursor, '\n', chunkEnd - cursor);
+                if (!lineEnd) lineEnd = chunkEnd;
+
+                const char *token = skip_obj_spaces(cursor, lineEnd);
+                const char *tokenEnd = token;
+                while (tokenEnd != lineEnd && !is_obj_space(*tokenEnd)) tokenEnd++;
+                const size_t tokenLength = tokenEnd - token;
+
+                if (tokenLength == 1 && token[0] == 'v')
                 {
-                    const VertexRef* p[3] = { &vertexRefCollection[0], &vertexRefCollection[i], &vertexRefCollection[i+1] };
+                    float x = 0;
+                    float y = 0;
+                    float z = 0;
+                    float w = 1;
+                    const char *p = parse_obj_float(tokenEnd, lineEnd, x);
+                    p = parse_obj_float(p, lineEnd, y);
+                    p = parse_obj_float(p, lineEnd, z);
+                    parse_obj_float(p, lineEnd, w);
+                    chunk.vertexPositionCollection.push_back(Vec4f{x, y, z, w});
+                }
 
-                    Triangle triangle;
-                    triangle.vertex0.position.assign(vertexPositionCollection[ p[0]->v ]);
-                    triangle.vertex1.position.assign(vertexPositionCollection[ p[1]->v ]);
-                    triangle.vertex2.position.assign(vertexPositionCollection[ p[2]->v ]);
+                else if (tokenLength == 2 && token[0] == 'v' && token[1] == 't')
+                {
+                    float u = 0;
+                    float v = 0;
+                    float w = 0;
+                    const char *p = parse_obj_float(tokenEnd, lineEnd, u);
+                    p = parse_obj_float(p, lineEnd, v);
+                    parse_obj_float(p, lineEnd, w);
+                    chunk.vertexTextureCoordinateCollection.push_back(Vec3f{u, v, w});
+                }
 
-                    triangle.vertex0.textureCoordinate.assign(vertexTextureCoordinateCollection[ p[0]->vt ]);
-                    triangle.vertex1.textureCoordinate.assign(vertexTextureCoordinateCollection[ p[1]->vt ]);
-                    triangle.vertex2.textureCoordinate.assign(vertexTextureCoordinateCollection[ p[2]->vt ]);
+                else if (tokenLength == 2 && token[0] == 'v' && token[1] == 'n')
+                {
+                    float i = 0; 
+                    float j = 0; 
+                    float k = 0;
+                    const char *p = parse_obj_float(tokenEnd, lineEnd, i);
+                    p = parse_obj_float(p, lineEnd, j);
+                    parse_obj_float(p, lineEnd, k);
+                    chunk.vertexNormalCollection.push_back(Vec4f{i, j, k, 1}.unitH());
+                }
 
-                    triangle.vertex0.normal.assign(vertexNormalCollection[ p[0]->vn ]);
-                    triangle.vertex1.normal.assign(vertexNormalCollection[ p[1]->vn ]);
-                    triangle.vertex2.normal.assign(vertexNormalCollection[ p[2]->vn ]);
+                else if (tokenLength == 1 && token[0] == 'f')
+                {
+                    ObjectFileFace face;
+                    face.firstRef = (uint32_t)chunk.vertexRefCollection.size();
+                    face.vCount = (uint32_t)chunk.vertexPositionCollection.size();
+                    face.vtCount = (uint32_t)chunk.vertexTextureCoordinateCollection.size();
+                    face.vnCount = (uint32_t)chunk.vertexNormalCollection.size();
 
-                    Vec4f U(vertexPositionCollection[ p[1]->v ].subtractH(vertexPositionCollection[ p[0]->v ]));
-                    Vec4f V(vertexPositionCollection[ p[2]->v ].subtractH(vertexPositionCollection[ p[0]->v ]));
-                    triangle.faceNormal.assign(U.crossH(V).unitH());
-                    triangle.asciiChar = ' ';
+                    const char *field = skip_obj_spaces(tokenEnd, lineEnd);
+                    while (field != lineEnd)
+                    {
+                        VertexRef ref;
+                        field = parse_obj_vertex_ref(field, lineEnd, ref);
+                        field = skip_obj_spaces(field, lineEnd);
+                        chunk.vertexRefCollection.push_back(ref);
+                    }
 
-                    mesh.addTriangle(triangle);
+                    face.refCount = (uint32_t)chunk.vertexRefCollection.size() - face.firstRef;
+                    if (face.refCount >= 3) chunk.faceCollection.push_back(face);
                 }
+
+                cursor = lineEnd == chunkEnd ? chunkEnd : lineEnd + 1;
             }
         }
-        objectFile.close();
+
+        // Resolve the chunk's references and triangulate its faces into welded, chunk-local ids.
+        inline void build_obj_chunk_indices(ObjectFileChunk &chunk, const size_t vSize, const std::string &fileName)
+        {
+            for (const ObjectFileFace &face : chunk.faceCollection)
+            {
+                VertexRef *refs = &chunk.vertexRefCollection[face.firstRef];
+                for (uint32_t i = 0; i < face.refCount; i++)
+                {
+                    refs[i].v  = resolve_obj_index(refs[i].v,  chunk.vBase  + face.vCount);
+                    refs[i].vt = resolve_obj_index(refs[i].vt, chunk.vtBase + face.vtCount);
+                    refs[i].vn = resolve_obj_index(refs[i].vn, chunk.vnBase + face.vnCount);
+                    if (refs[i].v < 0 || refs[i].v >= (int32_t)vSize)
+                        throw std::runtime_error(fileName + ": face references a missing vertex.");
+                }
+
+                const uint32_t first = chunk.welder.weld(refs[0]);
+                uint32_t previous = chunk.welder.weld(refs[1]);
+                for( size_t i = 1; i+1 < face.refCount; ++i )
+                {
+                    const uint32_t next = chunk.welder.weld(refs[i+1]);
+                    chunk.indexCollection.push_back(first);
+                    chunk.indexCollection.push_back(previous);
+                    chunk.indexCollection.push_back(next);
+                    previous = next;
+                }
+            }
+        }
+
+        // Run job(i) for i in [0, count), one thread per index beyond the first.
+        template<typename Job>
+        void run_obj_jobs(const size_t count, Job job)
+        {
+            std::vector<std::thread> threads;
+            std::vector<std::exception_ptr> errors(count);
+            for (size_t i = 1; i < count; i++)
+            {
+                threads.emplace_back([&, i]()
+                {
+                    try { job(i); }
+                    catch (...) { errors[i] = std::current_exception(); }
+                });
+            }
+
+            try { job(0); }
+            catch (...) { errors[0] = std::current_exception(); }
+
+            for (std::thread &thread : threads) thread.join();
+            for (const std::exception_ptr &error : errors)
+                if (error) std::rethrow_exception(error);
+        }
+    }
+
+    // Memory-maps the file and tokenizes it in place, without per-line allocations.
+    // With threadCount > 1 the file is split into line-aligned chunks that are parsed and
+    // triangulated on separate threads; 0 uses every hardware thread. OBJ's file-global,
+    // 1-based and negative indices are preserved, so the Mesh is the same for any count.
+    // The returned mesh has its bounding volume hierarchy built but no levels of detail; see
+    // Mesh::buildLods, which loading through the cache does before writing it.
+    Mesh constructMeshFromObjectFile(const std::string &fileName, unsigned threadCount = 1)
+    {
+        // Chunks smaller than this are not worth a thread.
+        constexpr size_t minChunkSize = 256 * 1024;
+
+        const MappedFile objectFile(fileName);
+
+        if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+        const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, objectFile.size() / minChunkSize));
+
+        // Split on line boundaries.
+        std::vector<detail::ObjectFileChunk> chunks(chunkCount);
+        const char *cursor = objectFile.begin();
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            const char *chunkEnd = objectFile.end();
+            if (i + 1 < chunkCount)
+            {
+                chunkEnd = std::max(cursor, objectFile.begin() + objectFile.size() * (i + 1) / chunkCount);
+                const char *lineEnd = (const char *)std::memchr(chunkEnd, '\n', objectFile.end() - chunkEnd);
+                chunkEnd = lineEnd ? lineEnd + 1 : objectFile.end();
+            }
+            chunks[i].begin = cursor;
+            chunks[i].end = chunkEnd;
+            cursor = chunkEnd;
+        }
+
+        detail::run_obj_jobs(chunkCount, [&](const size_t i) {detail::parse_obj_chunk(chunks[i]);});
+
+        // Prefix sums give every chunk its place in the file-wide collections.
+        size_t vCount = 0, vtCount = 0, vnCount = 0;
+        for (detail::ObjectFileChunk &chunk : chunks)
+        {
+            chunk.vBase = vCount;
+            chunk.vtBase = vtCount;
+            chunk.vnBase = vnCount;
+            vCount += chunk.vertexPositionCollection.size();
+            vtCount += chunk.vertexTextureCoordinateCollection.size();
+            vnCount += chunk.vertexNormalCollection.size();
+        }
+
+        std::vector<Vec4f> vertexPositionCollection;
+        std::vector<Vec3f> vertexTextureCoordinateCollection;
+        std::vector<Vec4f> vertexNormalCollection;
+        if (chunkCount == 1)
+        {
+            vertexPositionCollection.swap(chunks[0].vertexPositionCollection);
+            vertexTextureCoordinateCollection.swap(chunks[0].vertexTextureCoordinateCollection);
+            vertexNormalCollection.swap(chunks[0].vertexNormalCollection);
+        }
+        else
+        {
+            vertexPositionCollection.resize(vCount);
+            vertexTextureCoordinateCollection.resize(vtCount);
+            vertexNormalCollection.resize(vnCount);
+            detail::run_obj_jobs(chunkCount, [&](const size_t i)
+            {
+                detail::ObjectFileChunk &chunk = chunks[i];
+                std::copy(chunk.vertexPositionCollection.begin(), chunk.vertexPositionCollection.end(), vertexPositionCollection.begin() + chunk.vBase);
+                std::copy(chunk.vertexTextureCoordinateCollection.begin(), chunk.vertexTextureCoordinateCollection.end(), vertexTextureCoordinateCollection.begin() + chunk.vtBase);
+                std::copy(chunk.vertexNormalCollection.begin(), chunk.vertexNormalCollection.end(), vertexNormalCollection.begin() + chunk.vnBase);
+            });
+        }
+
+        detail::run_obj_jobs(chunkCount, [&](const size_t i) {detail::build_obj_chunk_indices(chunks[i], vCount, fileName);});
+
+        // Weld across chunks. Only the chunk-local unique tuples go through this serial pass.
+        std::vector<std::vector<uint32_t>> chunkRemap(chunkCount);
+        detail::VertexRefWelder fileWelder;
+        const detail::VertexRefWelder *welder = &chunks[0].welder;
+        if (chunkCount > 1)
+        {
+            for (size_t i = 0; i < chunkCount; i++)
+            {
+                const std::vector<VertexRef> &refCollection = chunks[i].welder.getRefCollection();
+                chunkRemap[i].resize(refCollection.size());
+                for (size_t j = 0; j < refCollection.size(); j++)
+                    chunkRemap[i][j] = fileWelder.weld(refCollection[j]);
+            }
+            welder = &fileWelder;
+        }
+
+        const Vec3f defaultTextureCoordinate{0, 0, 0};
+        const Vec4f defaultNormal{0, 0, 0, 1};
+        const std::vector<VertexRef> &uniqueRefCollection = welder->getRefCollection();
+
+        const size_t vertexCount = uniqueRefCollection.size();
+        PositionBuffer positionCollection;
+        std::vector<Vec3f> textureCoordinateCollection(vertexCount);
+        std::vector<Vec4f> normalCollection(vertexCount);
+        positionCollection.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            const VertexRef &ref = uniqueRefCollection[i];
+            positionCollection.set(i, vertexPositionCollection[ref.v]);
+            textureCoordinateCollection[i].assign(ref.vt >= 0 && ref.vt < (int32_t)vtCount ? vertexTextureCoordinateCollection[ref.vt] : defaultTextureCoordinate);
+            normalCollection[i].assign(ref.vn >= 0 && ref.vn < (int32_t)vnCount ? vertexNormalCollection[ref.vn] : defaultNormal);
+        }
+
+        size_t indexCount = 0;
+        std::vector<size_t> indexBase(chunkCount);
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            indexBase[i] = indexCount;
+            indexCount += chunks[i].indexCollection.size();
+        }
+
+        std::vector<uint32_t> indexCollection(indexCount);
+        std::vector<Vec4f> faceNormalCollection(indexCount / 3);
+        detail::run_obj_jobs(chunkCount, [&](const size_t i)
+        {
+            const std::vector<uint32_t> &chunkIndexCollection = chunks[i].indexCollection;
+            for (size_t j = 0; j < chunkIndexCollection.size(); j += 3)
+            {
+                uint32_t *triangle = &indexCollection[indexBase[i] + j];
+                for (int k = 0; k < 3; k++)
+                    triangle[k] = chunkCount > 1 ? chunkRemap[i][chunkIndexCollection[j + k]] : chunkIndexCollection[j + k];
+
+                const Vec4f p0 = positionCollection.get(triangle[0]);
+                Vec4f U(positionCollection.get(triangle[1]).subtractH(p0));
+                Vec4f V(positionCollection.get(triangle[2]).subtractH(p0));
+                faceNormalCollection[(indexBase[i] + j) / 3].assign(U.crossH(V).unitH());
+            }
+        });
+        Mesh mesh(std::move(positionCollection), std::move(textureCoordinateCollection), std::move(normalCollection),
+                  std::move(indexCollection), std::move(faceNormalCollection));
+        mesh.buildBvh();
         return mesh;
     }
 }
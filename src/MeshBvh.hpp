@@ -0,0 +1,320 @@
+#ifndef _MESH_BVH_HPP_
+#define _MESH_BVH_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#include "MathUtil.hpp"
+#include "VertexBatch.hpp"
+
+namespace cgel
+{
+    // Node of a mesh's bounding volume hierarchy, in model space. Triangles are stored in
+    // hierarchy order, so every node, leaf or not, covers the contiguous triangle range
+    // [triangleFirst, triangleFirst + triangleCount), and those triangles only use vertices
+    // in [vertexFirst, vertexEnd). An inner node's first child is the node right after it.
+    //
+    // The normal cone bounds the directions of the node's face normals: all of them are
+    // within the angle whose sine is coneCutoff of coneAxis. coneCutoff is 2 when the
+    // normals spread too far for the cone to cull anything.
+    struct BvhNode
+    {
+        float boundsMin[3];
+        float boundsMax[3];
+        float coneAxis[3];
+        float coneCutoff;
+        uint32_t triangleFirst;
+        uint32_t triangleCount;
+        uint32_t vertexFirst;
+        uint32_t vertexEnd;
+        uint32_t secondChild;
+        uint32_t padding[3];
+
+        bool isLeaf() const {return secondChild == 0;}
+    };
+
+    // True if every triangle under node faces away from camera (in model space): for every
+    // point p in the node's bounding sphere and face normal n in its cone, n . (p - camera) > 0.
+    // mirrored flips the normals, for transforms with a negative determinant.
+    inline bool bvh_node_backfacing(const BvhNode &node, const Vec4f &camera, const bool mirrored)
+    {
+        if (node.coneCutoff >= 1) return false;
+
+        const float halfX = (node.boundsMax[0] - node.boundsMin[0]) / 2;
+        const float halfY = (node.boundsMax[1] - node.boundsMin[1]) / 2;
+        const float halfZ = (node.boundsMax[2] - node.boundsMin[2]) / 2;
+        const float radius = std::sqrt(halfX * halfX + halfY * halfY + halfZ * halfZ);
+
+        const float dx = node.boundsMin[0] + halfX - camera.X();
+        const float dy = node.boundsMin[1] + halfY - camera.Y();
+        const float dz = node.boundsMin[2] + halfZ - camera.Z();
+        const float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+        const float along = (dx * node.coneAxis[0] + dy * node.coneAxis[1] + dz * node.coneAxis[2]) * (mirrored ? -1 : 1);
+        return along >= node.coneCutoff * distance + radius;
+    }
+
+    namespace detail
+    {
+        constexpr uint32_t BVH_LEAF_SIZE = 16;
+        constexpr int BVH_BIN_COUNT = 12;
+
+        struct BvhBox
+        {
+            float min[3] = {INFINITY, INFINITY, INFINITY};
+            float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+            void include(const float *p)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    min[a] = std::min(min[a], p[a]);
+                    max[a] = std::max(max[a], p[a]);
+                }
+            }
+
+            void include(const BvhBox &box)
+            {
+                include(box.min);
+                include(box.max);
+            }
+
+            float halfArea() const
+            {
+                if (min[0] > max[0]) return 0;
+                const float x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+                return x * y + y * z + z * x;
+            }
+        };
+
+        class BvhBuilder
+        {
+            private:
+                const std::vector<BvhBox> &m_boxes;
+                std::vector<float> m_centroids;
+                std::vector<uint32_t> &m_order;
+                std::vector<BvhNode> &m_nodes;
+
+                // Binned surface area heuristic: cost of a split is the child areas weighted by
+                // their triangle counts. Returns false if keeping a leaf is no worse.
+                bool m_find_split(const uint32_t begin, const uint32_t end, const BvhBox &bounds, int &bestAxis, float &bestPosition) const
+                {
+                    BvhBox centroidBounds;
+                    for (uint32_t i = begin; i < end; i++) centroidBounds.include(&m_centroids[3 * m_order[i]]);
+
+                    float bestCost = bounds.halfArea() * (end - begin);
+                    bool found = false;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        const float low = centroidBounds.min[axis], extent = centroidBounds.max[axis] - low;
+                        if (!(extent > 0)) continue;
+
+                        BvhBox binBoxes[BVH_BIN_COUNT];
+                        uint32_t binCounts[BVH_BIN_COUNT] = {};
+                        const float scale = BVH_BIN_COUNT / extent;
+                        for (uint32_t i = begin; i < end; i++)
+                        {
+                            const uint32_t t = m_order[i];
+                            const int bin = std::min((int)((m_centroids[3 * t + axis] - low) * scale), BVH_BIN_COUNT - 1);
+                            binBoxes[bin].include(m_boxes[t]);
+                            binCounts[bin]++;
+                        }
+
+                        // Sweep from the right to get the cost of every right side, then from the left.
+                        float rightArea[BVH_BIN_COUNT];
+                        uint32_t rightCount[BVH_BIN_COUNT];
+                        BvhBox right;
+                        uint32_t count = 0;
+                        for (int bin = BVH_BIN_COUNT - 1; bin > 0; bin--)
+                        {
+                            right.include(binBoxes[bin]);
+                            count += binCounts[bin];
+                            rightArea[bin] = right.halfArea();
+                            rightCount[bin] = count;
+                        }
+
+                        BvhBox left;
+                        count = 0;
+                        for (int bin = 0; bin < BVH_BIN_COUNT - 1; bin++)
+                        {
+                            left.include(binBoxes[bin]);
+                            count += binCounts[bin];
+                            if (count == 0 || rightCount[bin + 1] == 0) continue;
+
+                            const float cost = left.halfArea() * count + rightArea[bin + 1] * rightCount[bin + 1];
+                            if (cost < bestCost)
+                            {
+                                bestCost = cost;
+                                bestAxis = axis;
+                                bestPosition = low + (bin + 1) / scale;
+                                found = true;
+                            }
+                        }
+                    }
+                    return found;
+                }
+
+                uint32_t m_build(const uint32_t begin, const uint32_t end)
+                {
+                    const uint32_t index = (uint32_t)m_nodes.size();
+                    m_nodes.push_back(BvhNode{});
+
+                    BvhBox bounds;
+                    for (uint32_t i = begin; i < end; i++) bounds.include(m_boxes[m_order[i]]);
+                    for (int a = 0; a < 3; a++)
+                    {
+                        m_nodes[index].boundsMin[a] = bounds.min[a];
+                        m_nodes[index].boundsMax[a] = bounds.max[a];
+                    }
+                    m_nodes[index].triangleFirst = begin;
+                    m_nodes[index].triangleCount = end - begin;
+
+                    int axis = 0;
+                    float position = 0;
+                    if (end - begin <= BVH_LEAF_SIZE || !m_find_split(begin, end, bounds, axis, position))
+                    {
+                        // Too big to be a leaf even though no split pays off: halve it anyway.
+                        if (end - begin <= 4 * BVH_LEAF_SIZE) return index;
+                    }
+
+                    uint32_t middle = (uint32_t)(std::partition(m_order.begin() + begin, m_order.begin() + end, [&](const uint32_t t)
+                    {
+                        return m_centroids[3 * t + axis] < position;
+                    }) - m_order.begin());
+                    if (middle == begin || middle == end)
+                    {
+                        middle = begin + (end - begin) / 2;
+                        std::nth_element(m_order.begin() + begin, m_order.begin() + middle, m_order.begin() + end, [&](const uint32_t a, const uint32_t b)
+                        {
+                            return m_centroids[3 * a + axis] < m_centroids[3 * b + axis];
+                        });
+                    }
+
+                    m_build(begin, middle);
+                    const uint32_t secondChild = m_build(middle, end);
+                    m_nodes[index].secondChild = secondChild;
+                    return index;
+                }
+
+            public:
+                BvhBuilder(const std::vector<BvhBox> &boxes, std::vector<uint32_t> &order, std::vector<BvhNode> &nodes) :
+                    m_boxes(boxes),
+                    m_centroids(3 * boxes.size()),
+                    m_order(order),
+                    m_nodes(nodes)
+                {
+                    for (size_t t = 0; t < boxes.size(); t++)
+                        for (int a = 0; a < 3; a++)
+                            m_centroids[3 * t + a] = (boxes[t].min[a] + boxes[t].max[a]) / 2;
+                }
+
+                void build()
+                {
+                    if (!m_boxes.empty()) m_build(0, (uint32_t)m_boxes.size());
+                }
+        };
+    }
+
+    // Build a hierarchy over a mesh's triangles and reorder indices and faceNormals to match
+    // it. Every node's normal cone is filled in; its vertex range is left to the caller,
+    // which may still reorder vertices (see bvh_compute_vertex_ranges).
+    inline std::vector<BvhNode> build_mesh_bvh(const PositionStreams &positions, std::vector<uint32_t> &indices, std::vector<Vec4f> &faceNormals)
+    {
+        const size_t triangleCount = faceNormals.size();
+        std::vector<detail::BvhBox> boxes(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                const uint32_t i = indices[3 * t + k];
+                const float p[3] = {positions.x[i], positions.y[i], positions.z[i]};
+                boxes[t].include(p);
+            }
+        }
+
+        std::vector<uint32_t> order(triangleCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<BvhNode> nodes;
+        detail::BvhBuilder(boxes, order, nodes).build();
+
+        // Within a leaf, group triangles by the axis their normal is closest to, so triangles
+        // that face the same way, and mostly pass or fail the backface test together, are adjacent.
+        auto facing = [&](const uint32_t t)
+        {
+            const Vec4f &n = faceNormals[t];
+            const float ax = std::fabs(n.X()), ay = std::fabs(n.Y()), az = std::fabs(n.Z());
+            if (ax >= ay && ax >= az) return n.X() < 0 ? 1 : 0;
+            if (ay >= az) return n.Y() < 0 ? 3 : 2;
+            return n.Z() < 0 ? 5 : 4;
+        };
+        for (const BvhNode &node : nodes)
+        {
+            if (!node.isLeaf()) continue;
+            std::stable_sort(order.begin() + node.triangleFirst, order.begin() + node.triangleFirst + node.triangleCount, [&](const uint32_t a, const uint32_t b)
+            {
+                return facing(a) < facing(b);
+            });
+        }
+
+        std::vector<uint32_t> orderedIndices(indices.size());
+        std::vector<Vec4f> orderedFaceNormals(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            std::copy(&indices[3 * order[t]], &indices[3 * order[t]] + 3, &orderedIndices[3 * t]);
+            orderedFaceNormals[t] = faceNormals[order[t]];
+        }
+        indices.swap(orderedIndices);
+        faceNormals.swap(orderedFaceNormals);
+
+        for (BvhNode &node : nodes)
+        {
+            // Axis is the mean normal; the cone's half angle is the widest normal from it.
+            float axis[3] = {0, 0, 0};
+            bool degenerate = false;
+            for (uint32_t t = node.triangleFirst; t < node.triangleFirst + node.triangleCount; t++)
+            {
+                const Vec4f &n = faceNormals[t];
+                if (!std::isfinite(n.X()) || !std::isfinite(n.Y()) || !std::isfinite(n.Z())) degenerate = true;
+                axis[0] += n.X();
+                axis[1] += n.Y();
+                axis[2] += n.Z();
+            }
+
+            const float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            node.coneCutoff = 2;
+            if (degenerate || !(length > 0)) continue;
+            for (float &a : axis) a /= length;
+            std::copy(axis, axis + 3, node.coneAxis);
+
+            float minimumDot = 1;
+            for (uint32_t t = node.triangleFirst; t < node.triangleFirst + node.triangleCount; t++)
+            {
+                const Vec4f &n = faceNormals[t];
+                minimumDot = std::min(minimumDot, n.X() * axis[0] + n.Y() * axis[1] + n.Z() * axis[2]);
+            }
+            if (minimumDot > 0) node.coneCutoff = std::sqrt(1 - minimumDot * minimumDot);
+        }
+        return nodes;
+    }
+
+    // Fill in every node's vertex range from the (final) index buffer.
+    inline void bvh_compute_vertex_ranges(std::vector<BvhNode> &nodes, const std::vector<uint32_t> &indices)
+    {
+        for (BvhNode &node : nodes)
+        {
+            uint32_t first = UINT32_MAX, last = 0;
+            for (size_t i = 3 * (size_t)node.triangleFirst; i < 3 * ((size_t)node.triangleFirst + node.triangleCount); i++)
+            {
+                first = std::min(first, indices[i]);
+                last = std::max(last, indices[i]);
+            }
+            node.vertexFirst = node.triangleCount ? first : 0;
+            node.vertexEnd = node.triangleCount ? last + 1 : 0;
+        }
+    }
+}
+
+#endif
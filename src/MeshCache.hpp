@@ -0,0 +1,373 @@
+#ifndef _MESH_CACHE_HPP_
+#define _MESH_CACHE_HPP_
+
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <cstdint>
+#include <cstring>
+
+#include "Mesh.hpp"
+
+namespace cgel
+{
+    // Binary mesh cache, written next to the source file as "<file>.cgmesh", or "<file>.cgmeshz"
+    // for a compressed mesh.
+    //
+    // Layout: a MeshCacheHeader followed by one section per mesh array (see MeshCacheSection),
+    // each starting on a 64 byte boundary and stored exactly as it is in memory, so a mapped
+    // cache is used in place without parsing or copying. Sections of the other storage are
+    // empty. The mesh's levels of detail follow, each an image of its own laid out the same
+    // way from the next 64 byte boundary. Bump MESH_CACHE_VERSION whenever the layout (or the
+    // layout of Vec3f/Vec4f/BvhNode) changes.
+    constexpr uint32_t MESH_CACHE_MAGIC = 0x48534D43; // "CMSH"
+    constexpr uint32_t MESH_CACHE_VERSION = 5;
+
+    enum MeshCacheSection
+    {
+        MESH_CACHE_POSITION_X,
+        MESH_CACHE_POSITION_Y,
+        MESH_CACHE_POSITION_Z,
+        MESH_CACHE_POSITION_W,
+        MESH_CACHE_TEXTURE_COORDINATES,
+        MESH_CACHE_NORMALS,
+        MESH_CACHE_INDICES,
+        MESH_CACHE_FACE_NORMALS,
+        MESH_CACHE_BVH_NODES,
+        MESH_CACHE_QUANTIZED_X,
+        MESH_CACHE_QUANTIZED_Y,
+        MESH_CACHE_QUANTIZED_Z,
+        MESH_CACHE_PACKED_TEXTURE_COORDINATES,
+        MESH_CACHE_PACKED_NORMALS,
+        MESH_CACHE_PACKED_FACE_NORMALS,
+        MESH_CACHE_SECTION_COUNT
+    };
+
+    struct MeshCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vec3Size;
+        uint32_t vec4Size;
+
+        // Identifies the source file the cache was built from.
+        uint64_t sourceSize;
+        int64_t sourceModifiedTime;
+
+        uint64_t vertexCount;
+        uint64_t triangleCount;
+        uint64_t bvhNodeCount;
+        uint32_t storage;
+
+        // Number of level of detail images after this one; 0 in those images themselves.
+        uint32_t lodCount;
+
+        // Offsets are from the start of the image.
+        uint64_t sectionOffset[MESH_CACHE_SECTION_COUNT];
+        uint64_t sectionSize[MESH_CACHE_SECTION_COUNT];
+        uint64_t imageSize;
+
+        float boundsMin[3];
+        float boundsMax[3];
+
+        // Decode of compressed positions, see QuantizedPositionStreams.
+        float quantizationScale[3];
+        float quantizationOffset[3];
+
+        // See Mesh::addLod, 0 for the mesh itself.
+        float lodError;
+    };
+
+    namespace detail
+    {
+        inline uint64_t align_mesh_cache_offset(const uint64_t offset)
+        {
+            return (offset + 63) & ~(uint64_t)63;
+        }
+
+        // Fill in counts and section offsets for a mesh of the given size.
+        inline void layout_mesh_cache(MeshCacheHeader &header, const MeshStorage storage, const uint64_t vertexCount, const uint64_t triangleCount,
+                                      const uint64_t bvhNodeCount)
+        {
+            header.magic = MESH_CACHE_MAGIC;
+            header.version = MESH_CACHE_VERSION;
+            header.vec3Size = sizeof(Vec3f);
+            header.vec4Size = sizeof(Vec4f);
+            header.vertexCount = vertexCount;
+            header.triangleCount = triangleCount;
+            header.bvhNodeCount = bvhNodeCount;
+            header.storage = storage;
+
+            const uint64_t fullVertexCount = storage == MESH_STORAGE_FULL ? vertexCount : 0;
+            const uint64_t fullTriangleCount = storage == MESH_STORAGE_FULL ? triangleCount : 0;
+            header.sectionSize[MESH_CACHE_POSITION_X] = fullVertexCount * sizeof(float);
+            header.sectionSize[MESH_CACHE_POSITION_Y] = fullVertexCount * sizeof(float);
+            header.sectionSize[MESH_CACHE_POSITION_Z] = fullVertexCount * sizeof(float);
+            header.sectionSize[MESH_CACHE_POSITION_W] = fullVertexCount * sizeof(float);
+            header.sectionSize[MESH_CACHE_TEXTURE_COORDINATES] = fullVertexCount * sizeof(Vec3f);
+            header.sectionSize[MESH_CACHE_NORMALS] = fullVertexCount * sizeof(Vec4f);
+            header.sectionSize[MESH_CACHE_INDICES] = 3 * triangleCount * sizeof(uint32_t);
+            header.sectionSize[MESH_CACHE_FACE_NORMALS] = fullTriangleCount * sizeof(Vec4f);
+            header.sectionSize[MESH_CACHE_BVH_NODES] = bvhNodeCount * sizeof(BvhNode);
+
+            const uint64_t compressedVertexCount = vertexCount - fullVertexCount;
+            const uint64_t compressedTriangleCount = triangleCount - fullTriangleCount;
+            header.sectionSize[MESH_CACHE_QUANTIZED_X] = compressedVertexCount * sizeof(uint16_t);
+            header.sectionSize[MESH_CACHE_QUANTIZED_Y] = compressedVertexCount * sizeof(uint16_t);
+            header.sectionSize[MESH_CACHE_QUANTIZED_Z] = compressedVertexCount * sizeof(uint16_t);
+            header.sectionSize[MESH_CACHE_PACKED_TEXTURE_COORDINATES] = compressedVertexCount * sizeof(uint32_t);
+            header.sectionSize[MESH_CACHE_PACKED_NORMALS] = compressedVertexCount * sizeof(uint32_t);
+            header.sectionSize[MESH_CACHE_PACKED_FACE_NORMALS] = compressedTriangleCount * sizeof(uint32_t);
+
+            uint64_t offset = sizeof(MeshCacheHeader);
+            for (int i = 0; i < MESH_CACHE_SECTION_COUNT; i++)
+            {
+                header.sectionOffset[i] = align_mesh_cache_offset(offset);
+                offset = header.sectionOffset[i] + header.sectionSize[i];
+            }
+            header.imageSize = offset;
+        }
+
+        // Size and modification time of the source file, false if it cannot be read.
+        inline bool stat_mesh_source(const std::string &fileName, uint64_t &size, int64_t &modifiedTime)
+        {
+            std::error_code error;
+            size = std::filesystem::file_size(fileName, error);
+            if (error) return false;
+            modifiedTime = (int64_t)std::filesystem::last_write_time(fileName, error).time_since_epoch().count();
+            return !error;
+        }
+
+        // True if every index of arrays refers to one of its vertexCount vertices, and its
+        // hierarchy is a tree laid out as BvhNode describes whose ranges stay within the mesh,
+        // with each leaf's triangles only using the leaf's vertices. Mapped arrays are used
+        // without copying, so this is all that keeps a corrupted cache from making rendering
+        // read out of bounds.
+        inline bool validate_mesh_cache_arrays(const MeshArrays &arrays, const uint64_t vertexCount)
+        {
+            const uint32_t *indices = arrays.indexCollection;
+            for (size_t i = 0; i < 3 * arrays.triangleCount; i++)
+                if (indices[i] >= vertexCount) return false;
+
+            // Walking back from the last node, subtreeEnd[n] is one past the last node of n's
+            // subtree, which for an inner node must be where its second child's ends, with its
+            // first child's subtree ending right at the second child.
+            const BvhNode *nodes = arrays.bvhNodeCollection;
+            std::vector<uint32_t> subtreeEnd(arrays.bvhNodeCount);
+            for (size_t n = arrays.bvhNodeCount; n-- > 0;)
+            {
+                const BvhNode &node = nodes[n];
+                if ((uint64_t)node.triangleFirst + node.triangleCount > arrays.triangleCount ||
+                    node.vertexFirst > node.vertexEnd || node.vertexEnd > vertexCount)
+                {
+                    return false;
+                }
+
+                if (!node.isLeaf())
+                {
+                    if (node.secondChild <= n + 1 || node.secondChild >= arrays.bvhNodeCount || subtreeEnd[n + 1] != node.secondChild) return false;
+                    subtreeEnd[n] = subtreeEnd[node.secondChild];
+                    continue;
+                }
+                subtreeEnd[n] = (uint32_t)n + 1;
+                for (size_t i = 3 * (size_t)node.triangleFirst; i < 3 * ((size_t)node.triangleFirst + node.triangleCount); i++)
+                    if (indices[i] < node.vertexFirst || indices[i] >= node.vertexEnd) return false;
+            }
+            return arrays.bvhNodeCount == 0 || subtreeEnd[0] == arrays.bvhNodeCount;
+        }
+
+        // Map the image at imageOffset in mapping, with its header, into mesh. Returns false if
+        // it is malformed, from another format version, or built from a different source file.
+        inline bool map_mesh_cache_image(const std::shared_ptr<const MappedFile> &mapping, const uint64_t imageOffset, const uint64_t sourceSize,
+                                         const int64_t sourceModifiedTime, MeshCacheHeader &header, Mesh &mesh)
+        {
+            if (mapping->size() < imageOffset + sizeof(MeshCacheHeader)) return false;
+            std::memcpy(&header, mapping->data() + imageOffset, sizeof(header));
+
+            if (header.storage != MESH_STORAGE_FULL && header.storage != MESH_STORAGE_COMPRESSED) return false;
+
+            // Indices are 32 bit, and counts past that would overflow the layout's sizes.
+            if (header.vertexCount > UINT32_MAX || header.triangleCount > UINT32_MAX / 3 || header.bvhNodeCount > 2 * header.triangleCount + 1)
+                return false;
+
+            MeshCacheHeader expected{};
+            layout_mesh_cache(expected, (MeshStorage)header.storage, header.vertexCount, header.triangleCount, header.bvhNodeCount);
+            if (header.magic != expected.magic || header.version != expected.version ||
+                header.vec3Size != expected.vec3Size || header.vec4Size != expected.vec4Size ||
+                std::memcmp(header.sectionOffset, expected.sectionOffset, sizeof(header.sectionOffset)) != 0 ||
+                std::memcmp(header.sectionSize, expected.sectionSize, sizeof(header.sectionSize)) != 0 ||
+                header.imageSize != expected.imageSize || mapping->size() < imageOffset + header.imageSize)
+            {
+                return false;
+            }
+
+            if (header.sourceSize != sourceSize || header.sourceModifiedTime != sourceModifiedTime)
+                return false;
+
+            const char *base = mapping->data() + imageOffset;
+            const uint64_t *offset = header.sectionOffset;
+            const bool compressed = header.storage == MESH_STORAGE_COMPRESSED;
+            MeshArrays arrays{};
+            arrays.positions = PositionStreams{(const float *)(base + offset[MESH_CACHE_POSITION_X]),
+                                               (const float *)(base + offset[MESH_CACHE_POSITION_Y]),
+                                               (const float *)(base + offset[MESH_CACHE_POSITION_Z]),
+                                               (const float *)(base + offset[MESH_CACHE_POSITION_W]),
+                                               compressed ? 0 : header.vertexCount};
+            arrays.textureCoordinateCollection = (const Vec3f *)(base + offset[MESH_CACHE_TEXTURE_COORDINATES]);
+            arrays.normalCollection = (const Vec4f *)(base + offset[MESH_CACHE_NORMALS]);
+            arrays.indexCollection = (const uint32_t *)(base + offset[MESH_CACHE_INDICES]);
+            arrays.faceNormalCollection = (const Vec4f *)(base + offset[MESH_CACHE_FACE_NORMALS]);
+            arrays.triangleCount = header.triangleCount;
+            arrays.bvhNodeCollection = (const BvhNode *)(base + offset[MESH_CACHE_BVH_NODES]);
+            arrays.bvhNodeCount = header.bvhNodeCount;
+            arrays.storage = (MeshStorage)header.storage;
+            arrays.quantizedPositions = QuantizedPositionStreams{(const uint16_t *)(base + offset[MESH_CACHE_QUANTIZED_X]),
+                                                                 (const uint16_t *)(base + offset[MESH_CACHE_QUANTIZED_Y]),
+                                                                 (const uint16_t *)(base + offset[MESH_CACHE_QUANTIZED_Z]),
+                                                                 compressed ? header.vertexCount : 0,
+                                                                 Vec4f{header.quantizationScale[0], header.quantizationScale[1], header.quantizationScale[2], 1},
+                                                                 Vec4f{header.quantizationOffset[0], header.quantizationOffset[1], header.quantizationOffset[2], 1}};
+            arrays.packedTextureCoordinateCollection = (const uint32_t *)(base + offset[MESH_CACHE_PACKED_TEXTURE_COORDINATES]);
+            arrays.packedNormalCollection = (const uint32_t *)(base + offset[MESH_CACHE_PACKED_NORMALS]);
+            arrays.packedFaceNormalCollection = (const uint32_t *)(base + offset[MESH_CACHE_PACKED_FACE_NORMALS]);
+            if (!validate_mesh_cache_arrays(arrays, header.vertexCount)) return false;
+
+            mesh = Mesh(mapping, arrays,
+                        Vec4f{header.boundsMin[0], header.boundsMin[1], header.boundsMin[2], 1},
+                        Vec4f{header.boundsMax[0], header.boundsMax[1], header.boundsMax[2], 1});
+            return true;
+        }
+    }
+
+    inline std::string getMeshCacheFileName(const std::string &fileName, const MeshStorage storage = MESH_STORAGE_FULL)
+    {
+        return fileName + (storage == MESH_STORAGE_COMPRESSED ? ".cgmeshz" : ".cgmesh");
+    }
+
+    // Write mesh and its levels of detail to cacheFileName, stamped with the size and
+    // modification time of its source. Returns false if the cache could not be written; the
+    // mesh itself is unaffected.
+    inline bool writeMeshCache(const Mesh &mesh, const std::string &cacheFileName, const uint64_t sourceSize, const int64_t sourceModifiedTime)
+    {
+        // Write to a temporary file first so a reader never maps a half written cache.
+        const std::string temporaryFileName = cacheFileName + ".tmp";
+        {
+            std::ofstream cacheFile(temporaryFileName, std::ios::binary | std::ios::trunc);
+            if (!cacheFile.is_open()) return false;
+
+            const char padding[64] = {};
+            auto writeAt = [&](const uint64_t offset, const void *data, const uint64_t size)
+            {
+                const uint64_t position = (uint64_t)cacheFile.tellp();
+                cacheFile.write(padding, offset - position);
+                cacheFile.write((const char *)data, size);
+            };
+
+            uint64_t imageOffset = 0;
+            for (size_t level = 0; level < mesh.getLodCount(); level++)
+            {
+                const Mesh &image = mesh.getLod(level);
+                const MeshArrays arrays = image.getArrays();
+                MeshCacheHeader header{};
+                detail::layout_mesh_cache(header, arrays.storage, image.getVertexCount(), image.getTriangleCount(), image.getBvhNodeCollection().size());
+                header.sourceSize = sourceSize;
+                header.sourceModifiedTime = sourceModifiedTime;
+                header.lodCount = level == 0 ? (uint32_t)(mesh.getLodCount() - 1) : 0;
+                header.lodError = mesh.getLodError(level);
+                for (int i = 0; i < 3; i++)
+                {
+                    header.boundsMin[i] = image.getBoundsMin()[0][i];
+                    header.boundsMax[i] = image.getBoundsMax()[0][i];
+                    header.quantizationScale[i] = arrays.quantizedPositions.scale[0][i];
+                    header.quantizationOffset[i] = arrays.quantizedPositions.offset[0][i];
+                }
+
+                const void *sections[MESH_CACHE_SECTION_COUNT];
+                sections[MESH_CACHE_POSITION_X] = arrays.positions.x;
+                sections[MESH_CACHE_POSITION_Y] = arrays.positions.y;
+                sections[MESH_CACHE_POSITION_Z] = arrays.positions.z;
+                sections[MESH_CACHE_POSITION_W] = arrays.positions.w;
+                sections[MESH_CACHE_TEXTURE_COORDINATES] = arrays.textureCoordinateCollection;
+                sections[MESH_CACHE_NORMALS] = arrays.normalCollection;
+                sections[MESH_CACHE_INDICES] = arrays.indexCollection;
+                sections[MESH_CACHE_FACE_NORMALS] = arrays.faceNormalCollection;
+                sections[MESH_CACHE_BVH_NODES] = arrays.bvhNodeCollection;
+                sections[MESH_CACHE_QUANTIZED_X] = arrays.quantizedPositions.x;
+                sections[MESH_CACHE_QUANTIZED_Y] = arrays.quantizedPositions.y;
+                sections[MESH_CACHE_QUANTIZED_Z] = arrays.quantizedPositions.z;
+                sections[MESH_CACHE_PACKED_TEXTURE_COORDINATES] = arrays.packedTextureCoordinateCollection;
+                sections[MESH_CACHE_PACKED_NORMALS] = arrays.packedNormalCollection;
+                sections[MESH_CACHE_PACKED_FACE_NORMALS] = arrays.packedFaceNormalCollection;
+
+                writeAt(imageOffset, &header, sizeof(header));
+                for (int i = 0; i < MESH_CACHE_SECTION_COUNT; i++)
+                    writeAt(imageOffset + header.sectionOffset[i], sections[i], header.sectionSize[i]);
+                imageOffset = detail::align_mesh_cache_offset(imageOffset + header.imageSize);
+            }
+            if (!cacheFile.good()) return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporaryFileName, cacheFileName, error);
+        if (error) std::filesystem::remove(temporaryFileName, error);
+        return !error;
+    }
+
+    // Map cacheFileName and point mesh, and its levels of detail, at its arrays. Returns false
+    // if the cache is missing, malformed or corrupted, from another format version, or was
+    // built from a different source file.
+    inline bool constructMeshFromCache(const std::string &cacheFileName, const uint64_t sourceSize, const int64_t sourceModifiedTime, Mesh &mesh)
+    {
+        std::shared_ptr<const MappedFile> mapping;
+        try
+        {
+            mapping = std::make_shared<const MappedFile>(cacheFileName);
+        }
+        catch (const std::runtime_error &)
+        {
+            return false;
+        }
+
+        MeshCacheHeader header;
+        Mesh cachedMesh;
+        if (!detail::map_mesh_cache_image(mapping, 0, sourceSize, sourceModifiedTime, header, cachedMesh)) return false;
+
+        uint64_t imageOffset = 0;
+        const uint32_t lodCount = header.lodCount;
+        for (uint32_t level = 1; level <= lodCount; level++)
+        {
+            imageOffset = detail::align_mesh_cache_offset(imageOffset + header.imageSize);
+            Mesh lod;
+            if (!detail::map_mesh_cache_image(mapping, imageOffset, sourceSize, sourceModifiedTime, header, lod) || header.lodCount != 0) return false;
+            cachedMesh.addLod(std::move(lod), header.lodError);
+        }
+
+        mesh = std::move(cachedMesh);
+        return true;
+    }
+
+    // Load fileName through its binary cache: map the cache if it matches the source file's
+    // size and modification time and passes validation, otherwise parse the OBJ, build its
+    // levels of detail and (re)write the cache, so simplifying is paid once per source file.
+    // Each storage has its own cache file, so both can be used side by side.
+    inline Mesh constructMeshFromCachedObjectFile(const std::string &fileName, const unsigned threadCount = 1, const MeshStorage storage = MESH_STORAGE_FULL)
+    {
+        uint64_t sourceSize = 0;
+        int64_t sourceModifiedTime = 0;
+        if (!detail::stat_mesh_source(fileName, sourceSize, sourceModifiedTime))
+            throw std::runtime_error(fileName + " not found.");
+
+        const std::string cacheFileName = getMeshCacheFileName(fileName, storage);
+        Mesh mesh;
+        if (constructMeshFromCache(cacheFileName, sourceSize, sourceModifiedTime, mesh) && mesh.getStorage() == storage)
+            return mesh;
+
+        mesh = constructMeshFromObjectFile(fileName, threadCount);
+        mesh.buildLods();
+        if (storage == MESH_STORAGE_COMPRESSED) mesh.compress();
+        writeMeshCache(mesh, cacheFileName, sourceSize, sourceModifiedTime);
+        return mesh;
+    }
+}
+
+#endif
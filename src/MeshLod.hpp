@@ -0,0 +1,307 @@
+#ifndef _MESH_LOD_HPP_
+#define _MESH_LOD_HPP_
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#include "VertexBatch.hpp"
+
+namespace cgel
+{
+    // Levels of detail stop once halving the triangle count would go below this.
+    constexpr size_t MESH_LOD_MIN_TRIANGLES = 64;
+
+    // One simplified level of a mesh: its triangles, over the mesh's own vertex ids, and the
+    // root mean square distance the simplified surface strays from the original, in model
+    // units.
+    struct MeshLodLevel
+    {
+        std::vector<uint32_t> indexCollection;
+        float error;
+    };
+
+    namespace detail
+    {
+        // A boundary edge is held in place by the plane through it perpendicular to its face,
+        // weighted this much more than the faces themselves.
+        constexpr double LOD_BOUNDARY_WEIGHT = 10;
+
+        // Quadric error metric: the symmetric 4x4 matrix Q whose form p Q p^T, for p with w = 1,
+        // sums the squared distances of p to a set of planes, each scaled by a weight, and weight
+        // sums the weights, so p Q p^T / weight is the weighted mean.
+        struct LodQuadric
+        {
+            double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+            double weight;
+
+            // The plane n . p + d = 0, n unit length.
+            void addPlane(const double nx, const double ny, const double nz, const double d, const double scale)
+            {
+                a00 += scale * nx * nx; a01 += scale * nx * ny; a02 += scale * nx * nz; a03 += scale * nx * d;
+                a11 += scale * ny * ny; a12 += scale * ny * nz; a13 += scale * ny * d;
+                a22 += scale * nz * nz; a23 += scale * nz * d;
+                a33 += scale * d * d;
+                weight += scale;
+            }
+
+            void add(const LodQuadric &q)
+            {
+                a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+                a11 += q.a11; a12 += q.a12; a13 += q.a13;
+                a22 += q.a22; a23 += q.a23;
+                a33 += q.a33;
+                weight += q.weight;
+            }
+
+            double evaluate(const double x, const double y, const double z) const
+            {
+                return a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2 * (a03 * x + a13 * y + a23 * z) + a33;
+            }
+        };
+
+        // Collapse of vertex from onto vertex to, which stays where it is.
+        struct LodCollapse
+        {
+            uint32_t from;
+            uint32_t to;
+            double cost;
+        };
+
+        inline void lod_face_normal(const PositionStreams &p, const uint32_t i0, const uint32_t i1, const uint32_t i2, double n[3])
+        {
+            const double ux = p.x[i1] - p.x[i0], uy = p.y[i1] - p.y[i0], uz = p.z[i1] - p.z[i0];
+            const double vx = p.x[i2] - p.x[i0], vy = p.y[i2] - p.y[i0], vz = p.z[i2] - p.z[i0];
+            n[0] = uy * vz - uz * vy;
+            n[1] = uz * vx - ux * vz;
+            n[2] = ux * vy - uy * vx;
+        }
+
+        inline uint64_t lod_edge_key(const uint32_t a, const uint32_t b)
+        {
+            return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+        }
+
+        // Quadric of every vertex: the planes of its faces, weighted by their areas, plus boundary
+        // planes along its edges used by a single triangle.
+        inline std::vector<LodQuadric> build_lod_quadrics(const PositionStreams &positions, const std::vector<uint32_t> &indices)
+        {
+            std::vector<LodQuadric> quadrics(positions.count, LodQuadric{});
+            std::vector<std::pair<uint64_t, uint32_t>> edges;
+            edges.reserve(indices.size());
+            for (size_t t = 0; t < indices.size() / 3; t++)
+            {
+                const uint32_t *triangle = &indices[3 * t];
+                double n[3];
+                lod_face_normal(positions, triangle[0], triangle[1], triangle[2], n);
+                const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length > 0)
+                {
+                    const double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+                    const double d = -(nx * positions.x[triangle[0]] + ny * positions.y[triangle[0]] + nz * positions.z[triangle[0]]);
+                    for (int k = 0; k < 3; k++) quadrics[triangle[k]].addPlane(nx, ny, nz, d, length / 2);
+                }
+                for (int k = 0; k < 3; k++)
+                    edges.emplace_back(lod_edge_key(triangle[k], triangle[(k + 1) % 3]), (uint32_t)t);
+            }
+
+            std::sort(edges.begin(), edges.end());
+            for (size_t e = 0; e < edges.size();)
+            {
+                size_t next = e + 1;
+                while (next < edges.size() && edges[next].first == edges[e].first) next++;
+                if (next - e == 1)
+                {
+                    const uint32_t a = (uint32_t)(edges[e].first >> 32), b = (uint32_t)edges[e].first;
+                    const uint32_t *triangle = &indices[3 * edges[e].second];
+                    double n[3];
+                    lod_face_normal(positions, triangle[0], triangle[1], triangle[2], n);
+                    const double ex = positions.x[b] - positions.x[a], ey = positions.y[b] - positions.y[a], ez = positions.z[b] - positions.z[a];
+                    double mx = ey * n[2] - ez * n[1], my = ez * n[0] - ex * n[2], mz = ex * n[1] - ey * n[0];
+                    const double length = std::sqrt(mx * mx + my * my + mz * mz);
+                    if (length > 0)
+                    {
+                        mx /= length; my /= length; mz /= length;
+                        const double d = -(mx * positions.x[a] + my * positions.y[a] + mz * positions.z[a]);
+                        const double scale = LOD_BOUNDARY_WEIGHT * (ex * ex + ey * ey + ez * ez);
+                        quadrics[a].addPlane(mx, my, mz, d, scale);
+                        quadrics[b].addPlane(mx, my, mz, d, scale);
+                    }
+                }
+                e = next;
+            }
+            return quadrics;
+        }
+
+        // True if moving from onto to leaves every triangle around from that survives the
+        // collapse facing the way it did, and not degenerate.
+        inline bool lod_collapse_keeps_orientation(const PositionStreams &positions, const std::vector<uint32_t> &indices,
+                                                   const uint32_t *triangles, const uint32_t *trianglesEnd, const uint32_t from, const uint32_t to)
+        {
+            for (const uint32_t *t = triangles; t != trianglesEnd; t++)
+            {
+                const uint32_t *triangle = &indices[3 * *t];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) continue;
+
+                double before[3], after[3];
+                lod_face_normal(positions, triangle[0], triangle[1], triangle[2], before);
+                lod_face_normal(positions, triangle[0] == from ? to : triangle[0], triangle[1] == from ? to : triangle[1],
+                                triangle[2] == from ? to : triangle[2], after);
+                if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0) return false;
+            }
+            return true;
+        }
+
+        // Collapse edges, cheapest first, until at most targetTriangleCount triangles are left
+        // or no edge can go. Each pass ranks every edge by its quadric cost and collapses what
+        // it can without touching a vertex near an earlier collapse of the same pass, whose
+        // costs and neighbourhoods would be stale. Only about as many edges as are still needed
+        // are tried, so the cheap edges a pass had to skip get another chance before expensive
+        // ones go. error grows to the largest collapse's.
+        inline void collapse_lod_edges(const PositionStreams &positions, std::vector<LodQuadric> &quadrics, std::vector<uint32_t> &indices,
+                                       const size_t targetTriangleCount, float &error)
+        {
+            const size_t vertexCount = positions.count;
+            std::vector<uint32_t> firstTriangle(vertexCount + 1);
+            std::vector<uint32_t> vertexTriangles;
+            std::vector<uint64_t> edges;
+            std::vector<LodCollapse> collapses;
+            std::vector<unsigned char> locked(vertexCount);
+            std::vector<uint32_t> remap(vertexCount);
+
+            while (indices.size() / 3 > targetTriangleCount)
+            {
+                // Triangles around each vertex: vertexTriangles[firstTriangle[v] .. firstTriangle[v + 1]).
+                std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+                for (const uint32_t index : indices) firstTriangle[index + 1]++;
+                for (size_t v = 0; v < vertexCount; v++) firstTriangle[v + 1] += firstTriangle[v];
+                vertexTriangles.resize(indices.size());
+                for (size_t i = 0; i < indices.size(); i++) vertexTriangles[firstTriangle[indices[i]]++] = (uint32_t)(i / 3);
+                for (size_t v = vertexCount; v > 0; v--) firstTriangle[v] = firstTriangle[v - 1];
+                firstTriangle[0] = 0;
+
+                // Every edge once, in whichever direction costs less.
+                edges.clear();
+                for (size_t i = 0; i < indices.size(); i += 3)
+                    for (int k = 0; k < 3; k++) edges.push_back(lod_edge_key(indices[i + k], indices[i + (k + 1) % 3]));
+                std::sort(edges.begin(), edges.end());
+                edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+                collapses.clear();
+                for (const uint64_t edge : edges)
+                {
+                    const uint32_t a = (uint32_t)(edge >> 32), b = (uint32_t)edge;
+                    LodQuadric q = quadrics[a];
+                    q.add(quadrics[b]);
+                    const double aOntoB = q.evaluate(positions.x[b], positions.y[b], positions.z[b]);
+                    const double bOntoA = q.evaluate(positions.x[a], positions.y[a], positions.z[a]);
+                    collapses.push_back(aOntoB <= bOntoA ? LodCollapse{a, b, aOntoB} : LodCollapse{b, a, bOntoA});
+                }
+                std::sort(collapses.begin(), collapses.end(), [](const LodCollapse &l, const LodCollapse &r) {return l.cost < r.cost;});
+
+                std::fill(locked.begin(), locked.end(), 0);
+                std::iota(remap.begin(), remap.end(), 0);
+                size_t triangleCount = indices.size() / 3;
+                const size_t tryCount = triangleCount - targetTriangleCount;
+                bool collapsed = false;
+                for (size_t c = 0; c < collapses.size(); c++)
+                {
+                    const LodCollapse &collapse = collapses[c];
+                    if (triangleCount <= targetTriangleCount || (c >= tryCount && collapsed)) break;
+                    if (locked[collapse.from] || locked[collapse.to]) continue;
+
+                    const uint32_t *triangles = vertexTriangles.data() + firstTriangle[collapse.from];
+                    const uint32_t *trianglesEnd = vertexTriangles.data() + firstTriangle[collapse.from + 1];
+                    if (!lod_collapse_keeps_orientation(positions, indices, triangles, trianglesEnd, collapse.from, collapse.to)) continue;
+
+                    for (const uint32_t *t = triangles; t != trianglesEnd; t++)
+                    {
+                        const uint32_t *triangle = &indices[3 * *t];
+                        if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) triangleCount--;
+                        locked[triangle[0]] = locked[triangle[1]] = locked[triangle[2]] = 1;
+                    }
+                    remap[collapse.from] = collapse.to;
+                    quadrics[collapse.to].add(quadrics[collapse.from]);
+
+                    const double weight = quadrics[collapse.to].weight;
+                    error = std::max(error, (float)std::sqrt(std::max(collapse.cost, 0.0) / (weight > 0 ? weight : 1)));
+                    collapsed = true;
+                }
+                if (!collapsed) break;
+
+                // Apply the pass's collapses and drop the triangles they flattened.
+                size_t kept = 0;
+                for (size_t i = 0; i < indices.size(); i += 3)
+                {
+                    const uint32_t i0 = remap[indices[i]], i1 = remap[indices[i + 1]], i2 = remap[indices[i + 2]];
+                    if (i0 == i1 || i1 == i2 || i2 == i0) continue;
+                    indices[kept++] = i0;
+                    indices[kept++] = i1;
+                    indices[kept++] = i2;
+                }
+                indices.resize(kept);
+            }
+        }
+    }
+
+    // Simplify a mesh with quadric error metrics into a chain of levels, each with about half
+    // the triangles of the one before, coarsest last, stopping before a level would have fewer
+    // than minTriangleCount or once simplification stalls. Every level continues from the one
+    // before, so errors never decrease along the chain.
+    //
+    // Vertices are first merged by position, so seams in texture coordinates or normals do not
+    // tear the surface apart; a level's indices refer to the lowest id at each position.
+    inline std::vector<MeshLodLevel> build_mesh_lods(const PositionStreams &positions, const uint32_t *indexCollection, const size_t triangleCount,
+                                                     const size_t minTriangleCount = MESH_LOD_MIN_TRIANGLES)
+    {
+        const size_t vertexCount = positions.count;
+        std::vector<uint32_t> order(vertexCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&positions](const uint32_t a, const uint32_t b)
+        {
+            if (positions.x[a] != positions.x[b]) return positions.x[a] < positions.x[b];
+            if (positions.y[a] != positions.y[b]) return positions.y[a] < positions.y[b];
+            if (positions.z[a] != positions.z[b]) return positions.z[a] < positions.z[b];
+            return a < b;
+        });
+        std::vector<uint32_t> weld(vertexCount);
+        for (size_t k = 0; k < vertexCount; k++)
+        {
+            const uint32_t v = order[k], previous = k > 0 ? order[k - 1] : v;
+            const bool same = k > 0 && positions.x[v] == positions.x[previous] && positions.y[v] == positions.y[previous] && positions.z[v] == positions.z[previous];
+            weld[v] = same ? weld[previous] : v;
+        }
+
+        std::vector<uint32_t> indices;
+        indices.reserve(3 * triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            const uint32_t i0 = weld[indexCollection[3 * t]], i1 = weld[indexCollection[3 * t + 1]], i2 = weld[indexCollection[3 * t + 2]];
+            if (i0 == i1 || i1 == i2 || i2 == i0) continue;
+            indices.push_back(i0);
+            indices.push_back(i1);
+            indices.push_back(i2);
+        }
+
+        std::vector<detail::LodQuadric> quadrics = detail::build_lod_quadrics(positions, indices);
+        std::vector<MeshLodLevel> levels;
+        float error = 0;
+        size_t levelTriangleCount = triangleCount;
+        while (levelTriangleCount / 2 >= std::max<size_t>(minTriangleCount, 1))
+        {
+            detail::collapse_lod_edges(positions, quadrics, indices, levelTriangleCount / 2, error);
+            const size_t simplifiedCount = indices.size() / 3;
+            if (simplifiedCount == 0 || 4 * simplifiedCount > 3 * levelTriangleCount) break;
+
+            levels.push_back(MeshLodLevel{indices, error});
+            levelTriangleCount = simplifiedCount;
+        }
+        return levels;
+    }
+}
+
+#endif
@@ -1,13 +1,24 @@
 #ifndef _MISCUTIL_HPP_
 #define _MISCUTIL_HPP_
 
-#include <Windows.h>
+#include <utility>
+#include <cstring>
+#include <cstdint>
 #include "Mesh.hpp"
+#include "ConsoleBackend.hpp"
 
 namespace cgel
 {
+    // Keyboard state of the active console backend. Keys are Windows virtual-key codes.
     class Keyboard
     {
+        private:
+            static ConsoleBackend *&m_backend()
+            {
+                static ConsoleBackend *backend = nullptr;
+                return backend;
+            }
+
         public:
 
             enum
@@ -48,26 +59,31 @@ namespace cgel
                 Eight       = (unsigned short)'8',
                 Nine        = (unsigned short)'9',
                 Zero        = (unsigned short)'0',
-                Left        = VK_LEFT,
-                Right       = VK_RIGHT,
-                Up          = VK_UP,
-                Down        = VK_DOWN,
-                Space       = VK_SPACE,
-                Tab         = VK_TAB,
-                Return      = VK_RETURN,
-                Back        = VK_BACK,
-                LShift      = VK_LSHIFT,
-                LControl    = VK_LCONTROL,
-                LMenu       = VK_LMENU, 
-                RShift      = VK_RSHIFT,
-                RControl    = VK_RCONTROL,
-                RMenu       = VK_RMENU,
+                Left        = 0x25, // VK_LEFT
+                Right       = 0x27, // VK_RIGHT
+                Up          = 0x26, // VK_UP
+                Down        = 0x28, // VK_DOWN
+                Space       = 0x20, // VK_SPACE
+                Tab         = 0x09, // VK_TAB
+                Return      = 0x0D, // VK_RETURN
+                Back        = 0x08, // VK_BACK
+                LShift      = 0xA0, // VK_LSHIFT
+                LControl    = 0xA2, // VK_LCONTROL
+                LMenu       = 0xA4, // VK_LMENU
+                RShift      = 0xA1, // VK_RSHIFT
+                RControl    = 0xA3, // VK_RCONTROL
+                RMenu       = 0xA5, // VK_RMENU
 
             };
 
-            static BOOL isKeyPressed(const unsigned short key)
+            // The backend keys are read from, normally set by ConsoleGameEngine.
+            static void setBackend(ConsoleBackend *backend) {m_backend() = backend;}
+            static ConsoleBackend *getBackend() {return m_backend();}
+
+            static bool isKeyPressed(const unsigned short key)
             {
-                return GetAsyncKeyState(key) & 0x8000; 
+                const ConsoleBackend *backend = m_backend();
+                return backend && backend->isKeyPressed(key);
             }
 
     };
@@ -159,8 +175,196 @@ namespace cgel
         return 0;
     }
 
+    // Planes of the homogeneous clip space volume: -w <= x <= w, -w <= y <= w, 0 <= z <= w.
+    enum ClipPlane
+    {
+        CLIP_PLANE_NEAR   = 1 << 0,
+        CLIP_PLANE_FAR    = 1 << 1,
+        CLIP_PLANE_LEFT   = 1 << 2,
+        CLIP_PLANE_RIGHT  = 1 << 3,
+        CLIP_PLANE_BOTTOM = 1 << 4,
+        CLIP_PLANE_TOP    = 1 << 5,
+
+        CLIP_PLANES_DEPTH = CLIP_PLANE_NEAR | CLIP_PLANE_FAR,
+        CLIP_PLANES_ALL   = (1 << 6) - 1
+    };
+
+    constexpr int CLIP_PLANE_COUNT = 6;
+
+    // A convex polygon small enough to live on the stack. Clipping a triangle against each
+    // plane adds at most one vertex, so 3 + CLIP_PLANE_COUNT vertices always suffice.
+    template<typename Type>
+    struct ClipPolygon
+    {
+        static constexpr int CAPACITY = 3 + CLIP_PLANE_COUNT;
+
+        Vec4<Type> vertex[CAPACITY];
+        int count;
+    };
+
+    // Signed distance of p from a clip plane, positive inside.
+    template<typename Type>
+    Type clip_plane_distance(const Vec4<Type> &p, const int plane)
+    {
+        switch (plane)
+        {
+            case CLIP_PLANE_NEAR:   return p.Z();
+            case CLIP_PLANE_FAR:    return p.W() - p.Z();
+            case CLIP_PLANE_LEFT:   return p.W() + p.X();
+            case CLIP_PLANE_RIGHT:  return p.W() - p.X();
+            case CLIP_PLANE_BOTTOM: return p.W() + p.Y();
+            default:                return p.W() - p.Y();
+        }
+    }
+
+    // Bit mask of the planes in planes that p lies outside of.
+    template<typename Type>
+    int clip_outcode(const Vec4<Type> &p, const int planes = CLIP_PLANES_ALL)
+    {
+        int outcode = 0;
+        for (int plane = 1; plane <= planes; plane <<= 1)
+            if ((planes & plane) && clip_plane_distance(p, plane) < 0) outcode |= plane;
+        return outcode;
+    }
+
+    // Sutherland-Hodgman clip of polygon (in homogeneous clip space) against the planes whose
+    // bits are set in planes, in place. Returns the number of vertices left, 0 if it is gone.
+    template<typename Type>
+    int polygon_clip_homogeneous(ClipPolygon<Type> &polygon, const int planes)
+    {
+        ClipPolygon<Type> scratch;
+        ClipPolygon<Type> *in = &polygon;
+        ClipPolygon<Type> *out = &scratch;
+
+        for (int plane = 1; plane <= planes; plane <<= 1)
+        {
+            if (!(planes & plane)) continue;
+
+            // Rounding can make a nearly degenerate polygon cross a plane more than twice; never
+            // write past the end of the buffer because of it.
+            out->count = 0;
+            for (int i = 0; i < in->count && out->count <= ClipPolygon<Type>::CAPACITY - 2; i++)
+            {
+                const Vec4<Type> &a = in->vertex[i];
+                const Vec4<Type> &b = in->vertex[(i + 1) % in->count];
+                const Type da = clip_plane_distance(a, plane);
+                const Type db = clip_plane_distance(b, plane);
+
+                if (da >= 0) out->vertex[out->count++] = a;
+                if ((da >= 0) != (db >= 0)) out->vertex[out->count++] = a + (b - a) * (da / (da - db));
+            }
+
+            std::swap(in, out);
+            if (in->count < 3)
+            {
+                polygon.count = 0;
+                return 0;
+            }
+        }
+
+        if (in != &polygon) polygon = *in;
+        return polygon.count;
+    }
+
+    // The view volume of a row vector matrix m (p * m is in clip space) as planes in the space
+    // p is in, one per clip plane bit in bit order: (a, b, c, d) with a x + b y + c z + d >= 0
+    // inside. Normalised, so the expression is a distance.
+    template<typename Type>
+    void extract_frustum_planes(const Matrix<Type, 4, 4> &m, Vec4<Type> planes[CLIP_PLANE_COUNT])
+    {
+        const Vec4<Type> rows[4] = {{m[0][0], m[0][1], m[0][2], m[0][3]},
+                                    {m[1][0], m[1][1], m[1][2], m[1][3]},
+                                    {m[2][0], m[2][1], m[2][2], m[2][3]},
+                                    {m[3][0], m[3][1], m[3][2], m[3][3]}};
+        for (int i = 0; i < CLIP_PLANE_COUNT; i++)
+        {
+            // The plane distance is linear in the clip space point, so it can be applied to
+            // each row's contribution separately.
+            Vec4<Type> plane{clip_plane_distance(rows[0], 1 << i), clip_plane_distance(rows[1], 1 << i),
+                             clip_plane_distance(rows[2], 1 << i), clip_plane_distance(rows[3], 1 << i)};
+            const Type length = std::sqrt(plane.X() * plane.X() + plane.Y() * plane.Y() + plane.Z() * plane.Z());
+            if (length > 0) plane = plane * (1 / length);
+            planes[i] = plane;
+        }
+    }
+
+    // Test a bounding sphere, then where that is inconclusive its bounding box, against
+    // planes from extract_frustum_planes. Returns false if the volume is entirely outside
+    // one plane. Otherwise crossing gets the bits of the planes it may straddle; 0 means it
+    // is entirely inside. Only the planes in planeMask are tested, so a volume inside its
+    // parent's passes the parent's crossing bits.
+    template<typename Type>
+    bool frustum_test_bounds(const Vec4<Type> planes[CLIP_PLANE_COUNT], const Vec4<Type> &centre, const Type radius,
+                             const Vec4<Type> &boxMin, const Vec4<Type> &boxMax, int &crossing, const int planeMask = CLIP_PLANES_ALL)
+    {
+        crossing = 0;
+        for (int i = 0; i < CLIP_PLANE_COUNT; i++)
+        {
+            if (!(planeMask & (1 << i))) continue;
+            const Vec4<Type> &plane = planes[i];
+            const Type distance = plane.X() * centre.X() + plane.Y() * centre.Y() + plane.Z() * centre.Z() + plane.W();
+            if (distance < -radius) return false;
+            if (distance >= radius) continue;
+
+            // The box corners furthest along and against the plane normal.
+            const Type farthest = plane.X() * (plane.X() > 0 ? boxMax.X() : boxMin.X()) +
+                                  plane.Y() * (plane.Y() > 0 ? boxMax.Y() : boxMin.Y()) +
+                                  plane.Z() * (plane.Z() > 0 ? boxMax.Z() : boxMin.Z()) + plane.W();
+            const Type nearest = plane.X() * (plane.X() > 0 ? boxMin.X() : boxMax.X()) +
+                                 plane.Y() * (plane.Y() > 0 ? boxMin.Y() : boxMax.Y()) +
+                                 plane.Z() * (plane.Z() > 0 ? boxMin.Z() : boxMax.Z()) + plane.W();
+            if (farthest < 0) return false;
+            if (nearest < 0) crossing |= 1 << i;
+        }
+        return true;
+    }
+
+    // f's bits as an unsigned integer that orders the same way f does (-0 before +0, NaNs
+    // at the ends): flip the sign bit of positive floats and every bit of negative ones.
+    inline uint32_t float_sort_key(const float f)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return bits ^ ((uint32_t)((int32_t)bits >> 31) | 0x80000000u);
+    }
+
+    // Stable LSD radix sort of count items by their upper 32 bits, a byte per pass, ping-ponging
+    // between items and scratch. All four histograms are built in one read, and passes whose
+    // byte is the same in every item are skipped. Returns whichever of items and scratch holds
+    // the sorted result.
+    inline uint64_t *radix_sort_keys(uint64_t *items, uint64_t *scratch, const size_t count)
+    {
+        size_t histograms[4][256] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            const uint32_t key = (uint32_t)(items[i] >> 32);
+            histograms[0][key & 0xFF]++;
+            histograms[1][(key >> 8) & 0xFF]++;
+            histograms[2][(key >> 16) & 0xFF]++;
+            histograms[3][key >> 24]++;
+        }
+
+        for (int pass = 0; pass < 4; pass++)
+        {
+            size_t *histogram = histograms[pass];
+            const int shift = 32 + 8 * pass;
+            if (count == 0 || histogram[(items[0] >> shift) & 0xFF] == count) continue;
 
+            // Exclusive prefix sum turns the counts into each bucket's first output slot.
+            size_t offset = 0;
+            for (int bucket = 0; bucket < 256; bucket++)
+            {
+                const size_t bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
 
+            for (size_t i = 0; i < count; i++)
+                scratch[histogram[(items[i] >> shift) & 0xFF]++] = items[i];
+            std::swap(items, scratch);
+        }
+        return items;
+    }
 }
 
 #endif
@@ -0,0 +1,133 @@
+#ifndef _SCENE_GRAPH_HPP_
+#define _SCENE_GRAPH_HPP_
+
+#include <vector>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+
+#include "MathUtil.hpp"
+
+namespace cgel
+{
+    // Hierarchy of transforms. Every node has a local transform relative to its parent, built
+    // from make_translation_4x4, make_rotation*_4x4 and make_scaling_4x4 like any other, and
+    // the graph caches each node's world transform, local * parent's world.
+    //
+    // Nodes live in flat arrays in topological order: a node can only be added under one that
+    // already exists, so parents always come before their children and update() is a single
+    // linear sweep. Only nodes whose local transform changed, and their descendants, are
+    // recomputed, and the sweep starts at the first of them.
+    class SceneGraph
+    {
+        public:
+            static constexpr uint32_t NO_PARENT = UINT32_MAX;
+            static constexpr uint32_t NO_INSTANCE = UINT32_MAX;
+
+        private:
+            std::vector<uint32_t> m_parents;
+            std::vector<Matrix<float, 4, 4>> m_local_transforms;
+            std::vector<Matrix<float, 4, 4>> m_world_transforms;
+            std::vector<uint32_t> m_instances;
+
+            // m_dirty marks nodes whose local transform changed since the last update().
+            // m_updated_in holds the update() that last recomputed each node, so a child can see
+            // that its parent changed during this sweep without a second pass to clear flags.
+            std::vector<unsigned char> m_dirty;
+            std::vector<uint64_t> m_updated_in;
+            uint64_t m_update_count;
+            size_t m_first_dirty;
+
+            std::vector<uint32_t> m_updated_nodes;
+
+            void m_mark_dirty(const uint32_t node)
+            {
+                m_dirty[node] = 1;
+                if (node < m_first_dirty) m_first_dirty = node;
+            }
+
+        public:
+            SceneGraph() : m_update_count(0), m_first_dirty(0) {}
+
+            // Add a node under parent, or a root with NO_PARENT. instance is an engine instance
+            // (see Graphics3DEngine::addInstance) to move with the node, or NO_INSTANCE.
+            // Returns the node's index.
+            uint32_t addNode(const uint32_t parent = NO_PARENT, const Matrix<float, 4, 4> &localTransform = make_identity<float, 4>(),
+                             const uint32_t instance = NO_INSTANCE)
+            {
+                if (parent != NO_PARENT && parent >= m_parents.size())
+                    throw std::runtime_error("Scene graph node added under a missing parent.");
+
+                const uint32_t node = (uint32_t)m_parents.size();
+                m_parents.push_back(parent);
+                m_local_transforms.push_back(localTransform);
+                m_world_transforms.push_back(make_identity<float, 4>());
+                m_instances.push_back(instance);
+                m_dirty.push_back(0);
+                m_updated_in.push_back(0);
+                m_mark_dirty(node);
+                return node;
+            }
+
+            void reserve(const size_t nodeCount)
+            {
+                m_parents.reserve(nodeCount);
+                m_local_transforms.reserve(nodeCount);
+                m_world_transforms.reserve(nodeCount);
+                m_instances.reserve(nodeCount);
+                m_dirty.reserve(nodeCount);
+                m_updated_in.reserve(nodeCount);
+            }
+
+            // The node's world transform, and those of its descendants, are recomputed on the
+            // next update().
+            void setLocalTransform(const uint32_t node, const Matrix<float, 4, 4> &localTransform)
+            {
+                m_local_transforms[node] = localTransform;
+                m_mark_dirty(node);
+            }
+
+            void setInstance(const uint32_t node, const uint32_t instance)
+            {
+                m_instances[node] = instance;
+                m_mark_dirty(node);
+            }
+
+            // Recompute the world transforms of dirty nodes and their descendants. Returns the
+            // number of nodes recomputed, which getUpdatedNodes() lists.
+            size_t update()
+            {
+                m_updated_nodes.clear();
+                const size_t nodeCount = m_parents.size();
+                if (m_first_dirty >= nodeCount) return 0;
+
+                const uint64_t sweep = ++m_update_count;
+                for (size_t node = m_first_dirty; node < nodeCount; node++)
+                {
+                    const uint32_t parent = m_parents[node];
+                    const bool parentUpdated = parent != NO_PARENT && m_updated_in[parent] == sweep;
+                    if (!m_dirty[node] && !parentUpdated) continue;
+
+                    m_world_transforms[node] = parent == NO_PARENT ? m_local_transforms[node] : m_local_transforms[node] * m_world_transforms[parent];
+                    m_dirty[node] = 0;
+                    m_updated_in[node] = sweep;
+                    m_updated_nodes.push_back((uint32_t)node);
+                }
+                m_first_dirty = nodeCount;
+                return m_updated_nodes.size();
+            }
+
+            // Nodes recomputed by the last update(), in topological order.
+            const std::vector<uint32_t> &getUpdatedNodes() const {return m_updated_nodes;}
+
+            size_t getNodeCount() const {return m_parents.size();}
+            uint32_t getParent(const uint32_t node) const {return m_parents[node];}
+            uint32_t getInstance(const uint32_t node) const {return m_instances[node];}
+            const Matrix<float, 4, 4> &getLocalTransform(const uint32_t node) const {return m_local_transforms[node];}
+
+            // As of the last update().
+            const Matrix<float, 4, 4> &getWorldTransform(const uint32_t node) const {return m_world_transforms[node];}
+    };
+}
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef _VERTEX_BATCH_HPP_
+#define _VERTEX_BATCH_HPP_
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "MathUtil.hpp"
+
+namespace cgel
+{
+    // Structure-of-arrays view of vertex positions: x[i], y[i], z[i], w[i] is vertex i.
+    struct PositionStreams
+    {
+        const float *x;
+        const float *y;
+        const float *z;
+        const float *w;
+        size_t count;
+    };
+
+    // Structure-of-arrays view of positions quantized to 16 bits across a box: vertex i is
+    // (x[i], y[i], z[i]) * scale + offset, with w = 1.
+    struct QuantizedPositionStreams
+    {
+        const uint16_t *x;
+        const uint16_t *y;
+        const uint16_t *z;
+        size_t count;
+        Vec4f scale;
+        Vec4f offset;
+
+        Vec4f get(const size_t i) const
+        {
+            return {x[i] * scale.X() + offset.X(), y[i] * scale.Y() + offset.Y(), z[i] * scale.Z() + offset.Z(), 1};
+        }
+
+        // The decode as a transform, (x[i], y[i], z[i], 1) * decodeMatrix(), so it can be
+        // folded into whatever transform the positions go through next.
+        Matrix<float, 4, 4> decodeMatrix() const
+        {
+            return make_scaling_4x4<float>(scale) * make_translation_4x4<float>(offset);
+        }
+    };
+
+    // Packed unit vector that stands for the zero vector. Never produced for a unit vector,
+    // whose octahedral coordinates stay within -32767 .. 32767.
+    constexpr uint32_t OCTAHEDRAL_ZERO = 0x80008000;
+
+    // Unit vector n (its w is ignored) as 16 bit signed normalized octahedral coordinates,
+    // x in the low half: n is projected onto the octahedron |x| + |y| + |z| = 1 and the lower
+    // half is folded over the upper one. The zero vector becomes OCTAHEDRAL_ZERO.
+    inline uint32_t encode_octahedral(const Vec4f &n)
+    {
+        const float length = std::fabs(n.X()) + std::fabs(n.Y()) + std::fabs(n.Z());
+        if (!(length > 0)) return OCTAHEDRAL_ZERO;
+
+        float x = n.X() / length, y = n.Y() / length;
+        if (n.Z() < 0)
+        {
+            const float foldedX = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);
+            y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);
+            x = foldedX;
+        }
+        return (uint32_t)(uint16_t)(int16_t)std::lround(x * 32767) | (uint32_t)(uint16_t)(int16_t)std::lround(y * 32767) << 16;
+    }
+
+    // Direction, with w = 1, from encode_octahedral, not yet normalized: its length is between
+    // 1 / sqrt(3) and 1. Enough where only signs matter, such as facing tests.
+    inline Vec4f decode_octahedral_direction(const uint32_t packed)
+    {
+        if (packed == OCTAHEDRAL_ZERO) return {0, 0, 0, 1};
+
+        // Unfold the lower half without branching, since which half a normal is in is
+        // unpredictable: there x' = (1 - |y|) sign(x) = x - (|x| + |y| - 1) sign(x).
+        float x = (int16_t)(packed & 0xFFFF) * (1.0f / 32767), y = (int16_t)(packed >> 16) * (1.0f / 32767);
+        const float z = 1 - std::fabs(x) - std::fabs(y);
+        const float fold = std::max(-z, 0.0f);
+        x -= std::copysign(fold, x);
+        y -= std::copysign(fold, y);
+        return {x, y, z, 1};
+    }
+
+    // Unit vector, with w = 1, from encode_octahedral.
+    inline Vec4f decode_octahedral(const uint32_t packed)
+    {
+        const Vec4f direction = decode_octahedral_direction(packed);
+        const float lengthSquared = direction.dotH(direction);
+        return lengthSquared > 0 ? direction.multiplyH(1 / std::sqrt(lengthSquared)) : direction;
+    }
+
+    // IEEE 754 half precision bits of f, rounded to nearest even. Out of range values become
+    // infinity.
+    inline uint16_t float_to_half(const float f)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        const uint32_t sign = (bits >> 16) & 0x8000;
+        const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+        if (magnitude > 0x7F800000) return (uint16_t)(sign | 0x7E00);
+        if (magnitude >= 0x477FF000) return (uint16_t)(sign | 0x7C00);
+
+        uint32_t half, remainder, halfway;
+        if (magnitude >= 0x38800000)
+        {
+            // Normal: rebias the exponent and drop 13 mantissa bits.
+            half = (magnitude - 0x38000000) >> 13;
+            remainder = magnitude & 0x1FFF;
+            halfway = 0x1000;
+        }
+        else
+        {
+            // Subnormal, or zero below half the smallest subnormal.
+            if (magnitude < 0x33000000) return (uint16_t)sign;
+            const uint32_t shift = 126 - (magnitude >> 23);
+            const uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+            half = mantissa >> shift;
+            remainder = mantissa & ((1u << shift) - 1);
+            halfway = 1u << (shift - 1);
+        }
+        if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+        return (uint16_t)(sign | half);
+    }
+
+    inline float half_to_float(const uint16_t h)
+    {
+        const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        const uint32_t exponent = (h >> 10) & 0x1F;
+        const uint32_t mantissa = h & 0x3FF;
+
+        if (exponent == 0)
+        {
+            const float value = mantissa * (1.0f / 16777216);
+            return sign ? -value : value;
+        }
+
+        const uint32_t bits = exponent == 0x1F ? sign | 0x7F800000 | mantissa << 13 : sign | (exponent + 112) << 23 | mantissa << 13;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // Owning structure-of-arrays position storage. Resizing keeps the capacity, so a buffer
+    // reused every frame stops allocating once it has seen its largest mesh.
+    class PositionBuffer
+    {
+        private:
+            std::vector<float> m_x;
+            std::vector<float> m_y;
+            std::vector<float> m_z;
+            std::vector<float> m_w;
+
+        public:
+            void resize(const size_t count)
+            {
+                m_x.resize(count);
+                m_y.resize(count);
+                m_z.resize(count);
+                m_w.resize(count);
+            }
+
+            void push_back(const Vec4f &p)
+            {
+                m_x.push_back(p.X());
+                m_y.push_back(p.Y());
+                m_z.push_back(p.Z());
+                m_w.push_back(p.W());
+            }
+
+            void set(const size_t i, const Vec4f &p)
+            {
+                m_x[i] = p.X();
+                m_y[i] = p.Y();
+                m_z[i] = p.Z();
+                m_w[i] = p.W();
+            }
+
+            Vec4f get(const size_t i) const {return {m_x[i], m_y[i], m_z[i], m_w[i]};}
+
+            size_t size() const {return m_x.size();}
+
+            float *x() {return m_x.data();}
+            float *y() {return m_y.data();}
+            float *z() {return m_z.data();}
+            float *w() {return m_w.data();}
+            const float *x() const {return m_x.data();}
+            const float *y() const {return m_y.data();}
+            const float *z() const {return m_z.data();}
+            const float *w() const {return m_w.data();}
+
+            PositionStreams streams() const {return {m_x.data(), m_y.data(), m_z.data(), m_w.data(), m_x.size()};}
+    };
+
+    // out[i] = in[i] * m for count positions, in structure-of-arrays form. in and out may
+    // alias. The AVX path handles 8 positions per iteration, SSE 4, and the rest is scalar.
+    inline void transform_positions_soa(const float *inX, const float *inY, const float *inZ, const float *inW,
+                                        float *outX, float *outY, float *outZ, float *outW,
+                                        const size_t count, const Matrix<float, 4, 4> &m)
+    {
+        size_t i = 0;
+
+    #if defined(CGEL_AVX)
+        {
+            const __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]), m03 = _mm256_set1_ps(m[0][3]);
+            const __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]), m13 = _mm256_set1_ps(m[1][3]);
+            const __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]), m23 = _mm256_set1_ps(m[2][3]);
+            const __m256 m30 = _mm256_set1_ps(m[3][0]), m31 = _mm256_set1_ps(m[3][1]), m32 = _mm256_set1_ps(m[3][2]), m33 = _mm256_set1_ps(m[3][3]);
+
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m256 x = _mm256_loadu_ps(inX + i);
+                const __m256 y = _mm256_loadu_ps(inY + i);
+                const __m256 z = _mm256_loadu_ps(inZ + i);
+                const __m256 w = _mm256_loadu_ps(inW + i);
+
+                _mm256_storeu_ps(outX + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m00), _mm256_mul_ps(y, m10)), _mm256_add_ps(_mm256_mul_ps(z, m20), _mm256_mul_ps(w, m30))));
+                _mm256_storeu_ps(outY + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m01), _mm256_mul_ps(y, m11)), _mm256_add_ps(_mm256_mul_ps(z, m21), _mm256_mul_ps(w, m31))));
+                _mm256_storeu_ps(outZ + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m02), _mm256_mul_ps(y, m12)), _mm256_add_ps(_mm256_mul_ps(z, m22), _mm256_mul_ps(w, m32))));
+                _mm256_storeu_ps(outW + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m03), _mm256_mul_ps(y, m13)), _mm256_add_ps(_mm256_mul_ps(z, m23), _mm256_mul_ps(w, m33))));
+            }
+        }
+    #endif
+
+    #if defined(CGEL_SSE)
+        {
+            const __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]), m03 = _mm_set1_ps(m[0][3]);
+            const __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]), m13 = _mm_set1_ps(m[1][3]);
+            const __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]), m23 = _mm_set1_ps(m[2][3]);
+            const __m128 m30 = _mm_set1_ps(m[3][0]), m31 = _mm_set1_ps(m[3][1]), m32 = _mm_set1_ps(m[3][2]), m33 = _mm_set1_ps(m[3][3]);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                const __m128 x = _mm_loadu_ps(inX + i);
+                const __m128 y = _mm_loadu_ps(inY + i);
+                const __m128 z = _mm_loadu_ps(inZ + i);
+                const __m128 w = _mm_loadu_ps(inW + i);
+
+                _mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), _mm_mul_ps(w, m30))));
+                _mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), _mm_mul_ps(w, m31))));
+                _mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), _mm_mul_ps(w, m32))));
+                _mm_storeu_ps(outW + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m03), _mm_mul_ps(y, m13)), _mm_add_ps(_mm_mul_ps(z, m23), _mm_mul_ps(w, m33))));
+            }
+        }
+    #endif
+
+        // Copy the matrix so writes through the output pointers cannot force reloads.
+        const Matrix<float, 4, 4> c = m;
+        for (; i < count; i++)
+        {
+            const float x = inX[i], y = inY[i], z = inZ[i], w = inW[i];
+            outX[i] = (x * c[0][0] + y * c[1][0]) + (z * c[2][0] + w * c[3][0]);
+            outY[i] = (x * c[0][1] + y * c[1][1]) + (z * c[2][1] + w * c[3][1]);
+            outZ[i] = (x * c[0][2] + y * c[1][2]) + (z * c[2][2] + w * c[3][2]);
+            outW[i] = (x * c[0][3] + y * c[1][3]) + (z * c[2][3] + w * c[3][3]);
+        }
+    }
+
+    // Transform a whole set of streams into out, resizing it to match.
+    inline void transform_positions_soa(const PositionStreams &in, const Matrix<float, 4, 4> &m, PositionBuffer &out)
+    {
+        out.resize(in.count);
+        transform_positions_soa(in.x, in.y, in.z, in.w, out.x(), out.y(), out.z(), out.w(), in.count, m);
+    }
+
+    // out[i] = (inX[i], inY[i], inZ[i], 1) * m for count quantized positions, decoded to float
+    // on the way. m must already include the decode (see QuantizedPositionStreams::decodeMatrix),
+    // so dequantizing costs nothing beyond the integer to float conversion.
+    inline void transform_quantized_positions_soa(const uint16_t *inX, const uint16_t *inY, const uint16_t *inZ,
+                                                  float *outX, float *outY, float *outZ, float *outW,
+                                                  const size_t count, const Matrix<float, 4, 4> &m)
+    {
+        size_t i = 0;
+
+    #if defined(CGEL_AVX)
+        {
+            const __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]), m03 = _mm256_set1_ps(m[0][3]);
+            const __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]), m13 = _mm256_set1_ps(m[1][3]);
+            const __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]), m23 = _mm256_set1_ps(m[2][3]);
+            const __m256 m30 = _mm256_set1_ps(m[3][0]), m31 = _mm256_set1_ps(m[3][1]), m32 = _mm256_set1_ps(m[3][2]), m33 = _mm256_set1_ps(m[3][3]);
+            const __m128i zero = _mm_setzero_si128();
+
+            // Zero extend 8 lanes to 32 bits, a half at a time since that is all SSE2 and AVX offer.
+            auto load = [zero](const uint16_t *p)
+            {
+                const __m128i v = _mm_loadu_si128((const __m128i *)p);
+                return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero))),
+                                            _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), 1);
+            };
+
+            for (; i + 8 <= count; i += 8)
+            {
+                const __m256 x = load(inX + i);
+                const __m256 y = load(inY + i);
+                const __m256 z = load(inZ + i);
+
+                _mm256_storeu_ps(outX + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m00), _mm256_mul_ps(y, m10)), _mm256_add_ps(_mm256_mul_ps(z, m20), m30)));
+                _mm256_storeu_ps(outY + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m01), _mm256_mul_ps(y, m11)), _mm256_add_ps(_mm256_mul_ps(z, m21), m31)));
+                _mm256_storeu_ps(outZ + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m02), _mm256_mul_ps(y, m12)), _mm256_add_ps(_mm256_mul_ps(z, m22), m32)));
+                _mm256_storeu_ps(outW + i, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, m03), _mm256_mul_ps(y, m13)), _mm256_add_ps(_mm256_mul_ps(z, m23), m33)));
+            }
+        }
+    #endif
+
+    #if defined(CGEL_SSE)
+        {
+            const __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]), m03 = _mm_set1_ps(m[0][3]);
+            const __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]), m13 = _mm_set1_ps(m[1][3]);
+            const __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]), m23 = _mm_set1_ps(m[2][3]);
+            const __m128 m30 = _mm_set1_ps(m[3][0]), m31 = _mm_set1_ps(m[3][1]), m32 = _mm_set1_ps(m[3][2]), m33 = _mm_set1_ps(m[3][3]);
+            const __m128i zero = _mm_setzero_si128();
+
+            auto load = [zero](const uint16_t *p)
+            {
+                return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), zero));
+            };
+
+            for (; i + 4 <= count; i += 4)
+            {
+                const __m128 x = load(inX + i);
+                const __m128 y = load(inY + i);
+                const __m128 z = load(inZ + i);
+
+                _mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), m30)));
+                _mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), m31)));
+                _mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), m32)));
+                _mm_storeu_ps(outW + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m03), _mm_mul_ps(y, m13)), _mm_add_ps(_mm_mul_ps(z, m23), m33)));
+            }
+        }
+    #endif
+
+        const Matrix<float, 4, 4> c = m;
+        for (; i < count; i++)
+        {
+            const float x = inX[i], y = inY[i], z = inZ[i];
+            outX[i] = (x * c[0][0] + y * c[1][0]) + (z * c[2][0] + c[3][0]);
+            outY[i] = (x * c[0][1] + y * c[1][1]) + (z * c[2][1] + c[3][1]);
+            outZ[i] = (x * c[0][2] + y * c[1][2]) + (z * c[2][2] + c[3][2]);
+            outW[i] = (x * c[0][3] + y * c[1][3]) + (z * c[2][3] + c[3][3]);
+        }
+    }
+
+    // Decode and transform a whole set of quantized streams into out, resizing it to match.
+    inline void transform_positions_soa(const QuantizedPositionStreams &in, const Matrix<float, 4, 4> &m, PositionBuffer &out)
+    {
+        out.resize(in.count);
+        transform_quantized_positions_soa(in.x, in.y, in.z, out.x(), out.y(), out.z(), out.w(), in.count, in.decodeMatrix() * m);
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _WORKER_POOL_HPP_
+#define _WORKER_POOL_HPP_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+
+namespace cgel
+{
+    // Persistent worker threads for per-frame parallel loops. Threads are started once and
+    // sleep between jobs, and parallelFor neither allocates nor copies the loop body, so it
+    // is cheap enough to call several times a frame.
+    class WorkerPool
+    {
+        private:
+            std::vector<std::thread> m_threads;
+            std::mutex m_mutex;
+            std::condition_variable m_job_ready;
+            std::condition_variable m_job_done;
+
+            // The current job: m_job(m_context, i) for every i in [0, m_count).
+            void (*m_job)(void *, size_t);
+            void *m_context;
+            size_t m_count;
+            std::atomic<size_t> m_next;
+
+            uint64_t m_generation;
+            unsigned m_working;
+            bool m_stop;
+
+            // Claim indices until the job runs out. Indices are handed out one at a time, so
+            // uneven items (tiles with many triangles) balance across threads.
+            void m_run()
+            {
+                for (size_t i = m_next.fetch_add(1, std::memory_order_relaxed); i < m_count; i = m_next.fetch_add(1, std::memory_order_relaxed))
+                    m_job(m_context, i);
+            }
+
+            void m_work()
+            {
+                uint64_t generation = 0;
+                while (true)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_job_ready.wait(lock, [&]() {return m_stop || m_generation != generation;});
+                        if (m_stop) return;
+                        generation = m_generation;
+                    }
+
+                    m_run();
+
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (--m_working == 0) m_job_done.notify_one();
+                }
+            }
+
+        public:
+            // threadCount counts the calling thread, which also works during parallelFor.
+            // 0 uses every hardware thread.
+            explicit WorkerPool(unsigned threadCount = 0) :
+                m_job(nullptr),
+                m_context(nullptr),
+                m_count(0),
+                m_next(0),
+                m_generation(0),
+                m_working(0),
+                m_stop(false)
+            {
+                if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+                for (unsigned i = 1; i < threadCount; i++)
+                    m_threads.emplace_back(&WorkerPool::m_work, this);
+            }
+
+            ~WorkerPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_job_ready.notify_all();
+                for (std::thread &thread : m_threads) thread.join();
+            }
+
+            WorkerPool(const WorkerPool &) = delete;
+            WorkerPool &operator= (const WorkerPool &) = delete;
+
+            unsigned getThreadCount() const {return (unsigned)m_threads.size() + 1;}
+
+            // Call function(i) for every i in [0, count) across the pool and wait for all of them.
+            // function must not throw.
+            template<typename Function>
+            void parallelFor(const size_t count, Function &&function)
+            {
+                if (m_threads.empty() || count <= 1)
+                {
+                    for (size_t i = 0; i < count; i++) function(i);
+                    return;
+                }
+
+                using FunctionType = std::remove_reference_t<Function>;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_job = [](void *context, const size_t i) {(*(FunctionType *)context)(i);};
+                    m_context = (void *)&function;
+                    m_count = count;
+                    m_next.store(0, std::memory_order_relaxed);
+                    m_working = (unsigned)m_threads.size();
+                    m_generation++;
+                }
+                m_job_ready.notify_all();
+
+                m_run();
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_done.wait(lock, [&]() {return m_working == 0;});
+            }
+    };
+}
+
+#endif
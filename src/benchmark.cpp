@@ -0,0 +1,450 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+#include "Graphics3DEngine.hpp"
+#include "MeshCache.hpp"
+
+// Rendering benchmarks over the bundled meshes. Run from src so ObjectFiles/ resolves:
+//
+//     benchmark [--format csv|json] [--out file] [--quick]
+//
+// Every scenario is timed for a number of samples and reported as one row with the median,
+// mean and 95th percentile sample time plus a throughput in the row's unit. Scenarios that
+// do not depend on the screen size report a resolution of 0x0.
+namespace
+{
+    struct Resolution
+    {
+        int width;
+        int height;
+    };
+
+    struct Result
+    {
+        std::string scenario;
+        std::string mesh;
+        Resolution resolution;
+        size_t samples;
+        double medianMs;
+        double meanMs;
+        double p95Ms;
+        double itemsPerSecond;
+        std::string unit;
+    };
+
+    const char *const MESH_FILES[] = {"ObjectFiles/sword.obj", "ObjectFiles/tower.obj"};
+    const Resolution RESOLUTIONS[] = {{80, 30}, {160, 60}, {320, 120}, {640, 240}};
+    const int ORBIT_FRAMES = 120;
+    const int INSTANCE_GRID_SIDE = 10;
+    const int SCENE_GRAPH_NODES = 10000;
+    const size_t SORT_TRIANGLES = 1 << 20;
+    const int LOAD_GRID_SIDE = 300;
+
+    double g_minSeconds = 0.25;
+    std::vector<Result> g_results;
+
+    // Results that would otherwise be unused go here, so the work producing them is kept.
+    volatile size_t g_sink;
+
+    // Run sample() until at least g_minSeconds have passed and at least 5 samples were taken,
+    // then record the result. sample() returns how many items it processed.
+    void measure(const std::string &scenario, const std::string &mesh, const Resolution resolution, const std::string &unit,
+                 const std::function<size_t()> &sample)
+    {
+        std::vector<double> times;
+        size_t items = 0;
+        double elapsed = 0;
+        while ((elapsed < g_minSeconds || times.size() < 5) && times.size() < 100000)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            items = sample();
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            times.push_back(ms);
+            elapsed += ms / 1000;
+        }
+
+        double total = 0;
+        for (const double time : times) total += time;
+        const double mean = total / times.size();
+        std::sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+
+        g_results.push_back(Result{scenario, mesh, resolution, times.size(), median, mean,
+                                   times[std::min(times.size() - 1, times.size() * 95 / 100)],
+                                   median > 0 ? items / (median / 1000) : 0, unit});
+        std::fprintf(stderr, "%-12s %-10s %4dx%-4d median %9.4f ms  %12.0f %s\n", scenario.c_str(), mesh.c_str(),
+                     resolution.width, resolution.height, median, g_results.back().itemsPerSecond, unit.c_str());
+    }
+
+    std::string meshName(const std::string &fileName)
+    {
+        const size_t slash = fileName.find_last_of('/');
+        const size_t dot = fileName.find_last_of('.');
+        return fileName.substr(slash + 1, dot - slash - 1);
+    }
+
+    // Loading: parsing the OBJ on one thread and on all of them, and mapping the binary cache.
+    void benchmarkLoad(const std::string &fileName)
+    {
+        const std::string name = meshName(fileName);
+
+        // Make sure the cache is written before it is timed.
+        cgel::constructMeshFromCachedObjectFile(fileName);
+
+        measure("load_obj", name, {0, 0}, "triangles/s", [&]() {return cgel::constructMeshFromObjectFile(fileName, 1).getTriangleCount();});
+        measure("load_obj_mt", name, {0, 0}, "triangles/s", [&]() {return cgel::constructMeshFromObjectFile(fileName, 0).getTriangleCount();});
+        measure("load_cache", name, {0, 0}, "triangles/s", [&]() {return cgel::constructMeshFromCachedObjectFile(fileName).getTriangleCount();});
+    }
+
+    // Write a side x side grid of quads with texture coordinates and normals as an OBJ file of
+    // some 12 MB, large enough for the loader to split across threads.
+    void writeGridObjectFile(const std::string &fileName, const int side)
+    {
+        FILE *file = std::fopen(fileName.c_str(), "w");
+        if (!file) throw std::runtime_error("Cannot open " + fileName + " for writing.");
+        for (int y = 0; y <= side; y++)
+            for (int x = 0; x <= side; x++)
+            {
+                const float u = (float)x / side, v = (float)y / side;
+                std::fprintf(file, "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn 0 0 1\n", u, v, 0.05f * (float)((x * 7 + y * 13) % 11), u, v);
+            }
+        for (int y = 0; y < side; y++)
+            for (int x = 0; x < side; x++)
+            {
+                const int a = y * (side + 1) + x + 1, b = a + 1, c = a + side + 2, d = a + side + 1;
+                std::fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+            }
+        std::fclose(file);
+    }
+
+    // Parsing a generated OBJ on 1, 2, 4 and all hardware threads. The bundled meshes are
+    // below the loader's minimum chunk size, so only a file this large shows how it scales.
+    void benchmarkLoadScaling()
+    {
+        const std::string fileName = (std::filesystem::temp_directory_path() / "cgel_benchmark_grid.obj").string();
+        writeGridObjectFile(fileName, LOAD_GRID_SIDE);
+
+        const std::pair<const char *, unsigned> threadCounts[] = {{"load_obj", 1}, {"load_obj_2t", 2}, {"load_obj_4t", 4}, {"load_obj_mt", 0}};
+        try
+        {
+            for (const std::pair<const char *, unsigned> &threads : threadCounts)
+                measure(threads.first, "grid", {0, 0}, "triangles/s", [&]() {return cgel::constructMeshFromObjectFile(fileName, threads.second).getTriangleCount();});
+        }
+        catch (...)
+        {
+            std::filesystem::remove(fileName);
+            throw;
+        }
+        std::filesystem::remove(fileName);
+    }
+
+    // Model to clip space transform of every vertex, from full and from compressed storage.
+    void benchmarkTransform(const std::string &name, const cgel::Mesh &mesh)
+    {
+        cgel::PositionBuffer out;
+        const cgel::Matrix<float, 4, 4> m = cgel::make_rotationY_4x4<float>(0.5f) * cgel::make_projection_4x4<float>(160, 60);
+        measure("transform", name, {0, 0}, "vertices/s", [&]()
+        {
+            cgel::transform_positions_soa(mesh.getPositionStreams(), m, out);
+            return mesh.getVertexCount();
+        });
+
+        cgel::Mesh compressed = mesh;
+        compressed.compress();
+        measure("transform_z", name, {0, 0}, "vertices/s", [&]()
+        {
+            cgel::transform_positions_soa(compressed.getQuantizedPositionStreams(), m, out);
+            return compressed.getVertexCount();
+        });
+    }
+
+    // Building the mesh's chain of levels of detail, in source triangles per second.
+    void benchmarkBuildLods(const std::string &name, const cgel::Mesh &mesh)
+    {
+        cgel::Mesh simplified = mesh;
+        measure("build_lods", name, {0, 0}, "triangles/s", [&]()
+        {
+            simplified.buildLods();
+            return mesh.getTriangleCount();
+        });
+    }
+
+    // Outcode rejection and polygon clipping of every triangle, as the engine does it, from
+    // a camera outside the mesh and from one at its centre (where many triangles straddle the
+    // near plane).
+    void benchmarkClip(const std::string &name, const cgel::Mesh &mesh, const Resolution resolution)
+    {
+        cgel::Graphics3DEngine engine(resolution.width, resolution.height, cgel::HALF_PI, 0.01, 100, 1,
+                                      std::unique_ptr<cgel::ConsoleBackend>(new cgel::HeadlessBackend(resolution.width, resolution.height)));
+        engine.setCameraOrbit(mesh, 0.7f, 0.3f);
+
+        const cgel::Matrix<float, 4, 4> modelMatrix = cgel::make_translation_4x4<float>({-0.5, -0.5, -0.5, 1}) *
+                                                      cgel::make_translation_4x4<float>(cgel::Graphics3DEngine::getMeshOrigin());
+        const cgel::Matrix<float, 4, 4> projectionMatrix = cgel::make_scaling_4x4<float>({-1, -1, 1, 1}) *
+                                                           cgel::make_projection_4x4<float>(resolution.width, resolution.height, cgel::HALF_PI, 0.01, 100);
+        const cgel::ArrayView<uint32_t> indices = mesh.getIndexCollection();
+
+        const std::pair<const char *, cgel::Vec4f> cameras[] = {{"clip_orbit", engine.getCameraPosition()},
+                                                                 {"clip_inside", cgel::Graphics3DEngine::getMeshCentre(mesh)}};
+        for (const auto &camera : cameras)
+        {
+            const cgel::Vec4f target = camera.second.addH(cgel::Graphics3DEngine::getCameraLookDirection(0.7f, 0.3f));
+            const cgel::Matrix<float, 4, 4> viewMatrix = cgel::make_quick_inverse_4x4<float>(cgel::make_pointat_4x4<float>(camera.second, target, {0, 1, 0, 1}));
+            cgel::PositionBuffer clip;
+            cgel::transform_positions_soa(mesh.getPositionStreams(), modelMatrix * viewMatrix * projectionMatrix, clip);
+
+            size_t outputVertices = 0;
+            measure(camera.first, name, resolution, "triangles/s", [&]()
+            {
+                for (size_t t = 0; t < mesh.getTriangleCount(); t++)
+                {
+                    cgel::ClipPolygon<float> polygon;
+                    polygon.vertex[0] = clip.get(indices[3 * t + 0]);
+                    polygon.vertex[1] = clip.get(indices[3 * t + 1]);
+                    polygon.vertex[2] = clip.get(indices[3 * t + 2]);
+                    polygon.count = 3;
+
+                    const int outcode0 = cgel::clip_outcode(polygon.vertex[0]);
+                    const int outcode1 = cgel::clip_outcode(polygon.vertex[1]);
+                    const int outcode2 = cgel::clip_outcode(polygon.vertex[2]);
+                    if (outcode0 & outcode1 & outcode2) continue;
+                    if ((outcode0 | outcode1 | outcode2) & cgel::CLIP_PLANES_ALL) cgel::polygon_clip_homogeneous(polygon, cgel::CLIP_PLANES_ALL);
+                    outputVertices += polygon.count;
+                }
+                return mesh.getTriangleCount();
+            });
+            g_sink = outputVertices;
+        }
+    }
+
+    // Depth tested solid fill of a fixed set of triangles scaled to the screen, in cells written.
+    void benchmarkRaster(const Resolution resolution)
+    {
+        cgel::ConsoleGameEngine engine(resolution.width, resolution.height,
+                                       std::unique_ptr<cgel::ConsoleBackend>(new cgel::HeadlessBackend(resolution.width, resolution.height)));
+
+        // A fixed pseudo random sequence, so every run draws the same triangles.
+        uint32_t seed = 12345;
+        auto random = [&seed]() {seed = seed * 1664525u + 1013904223u; return (seed >> 8) * (1.0f / 16777216.0f);};
+
+        std::vector<cgel::Vec3f> vertices;
+        const float size = 0.25f;
+        for (int i = 0; i < 256; i++)
+        {
+            const float x = random() * resolution.width, y = random() * resolution.height, z = random();
+            for (int j = 0; j < 3; j++)
+                vertices.push_back(cgel::Vec3f{x + (random() - 0.5f) * size * resolution.width, y + (random() - 0.5f) * size * resolution.height, z});
+        }
+
+        // Count the cells once; every run writes the same ones.
+        size_t cells = 0;
+        engine.clear();
+        for (size_t i = 0; i < vertices.size(); i += 3)
+            engine.drawTriangle(vertices[i], vertices[i + 1], vertices[i + 2], [&cells](long, long, float, float, float) {cells++; return '#';});
+
+        measure("raster", "-", resolution, "cells/s", [&]()
+        {
+            engine.clear();
+            for (size_t i = 0; i < vertices.size(); i += 3)
+                engine.drawTriangle(vertices[i], vertices[i + 1], vertices[i + 2], '#');
+            return cells;
+        });
+    }
+
+    // Depth sorting a draw list of SORT_TRIANGLES triangles as the engine does it: a key per
+    // triangle from its vertex depths above its index, radix sorted.
+    void benchmarkSort()
+    {
+        uint32_t seed = 12345;
+        auto random = [&seed]() {seed = seed * 1664525u + 1013904223u; return (seed >> 8) * (1.0f / 16777216.0f);};
+
+        std::vector<float> depths(3 * SORT_TRIANGLES);
+        for (float &depth : depths) depth = 0.9f + 0.1f * random();
+
+        std::vector<uint64_t> items(SORT_TRIANGLES), scratch(SORT_TRIANGLES);
+        measure("sort", "-", {0, 0}, "triangles/s", [&]()
+        {
+            for (size_t i = 0; i < SORT_TRIANGLES; i++)
+                items[i] = (uint64_t)cgel::float_sort_key(depths[3 * i] + depths[3 * i + 1] + depths[3 * i + 2]) << 32 | i;
+            g_sink = (size_t)cgel::radix_sort_keys(items.data(), scratch.data(), SORT_TRIANGLES)[0];
+            return SORT_TRIANGLES;
+        });
+    }
+
+    // Whole frames (update and display) along a scripted orbit around the mesh.
+    void benchmarkFrame(const std::string &fileName, const Resolution resolution)
+    {
+        cgel::Graphics3DEngine engine(resolution.width, resolution.height, cgel::HALF_PI, 0.01, 100, 0,
+                                      std::unique_ptr<cgel::ConsoleBackend>(new cgel::HeadlessBackend(resolution.width, resolution.height)));
+        const cgel::Mesh mesh = cgel::constructMeshFromCachedObjectFile(fileName);
+        engine.addMesh(mesh);
+
+        int frame = 0;
+        measure("frame", meshName(fileName), resolution, "frames/s", [&]()
+        {
+            engine.setCameraOrbit(mesh, 2 * cgel::PI * (frame++ % ORBIT_FRAMES) / ORBIT_FRAMES, 0.3f);
+            engine.update();
+            engine.display();
+            return (size_t)1;
+        });
+    }
+
+    // Whole frames of a grid of instances of one mesh, all sharing its geometry, from a
+    // camera looking across the grid, in instances per second.
+    void benchmarkInstances(const std::string &fileName, const Resolution resolution)
+    {
+        cgel::Graphics3DEngine engine(resolution.width, resolution.height, cgel::HALF_PI, 0.01, 100, 0,
+                                      std::unique_ptr<cgel::ConsoleBackend>(new cgel::HeadlessBackend(resolution.width, resolution.height)));
+        const cgel::MeshHandle mesh = cgel::makeMeshHandle(cgel::constructMeshFromCachedObjectFile(fileName));
+
+        const int side = INSTANCE_GRID_SIDE;
+        for (int row = 0; row < side; row++)
+        {
+            for (int column = 0; column < side; column++)
+            {
+                const cgel::Matrix<float, 4, 4> transform = cgel::make_scaling_4x4<float>({0.3f, 0.3f, 0.3f, 1}) *
+                                                            cgel::make_rotationY_4x4<float>(0.7f * column + row) *
+                                                            cgel::make_translation_4x4<float>({0.6f * (column - side / 2), -1, 0.6f * row - 3, 1});
+                engine.addInstance(mesh, cgel::Graphics3DEngine::getMeshPlacement(transform));
+            }
+        }
+        engine.setCamera({0, 1, -6, 1}, 0, 0.3f);
+
+        measure("instances", meshName(fileName), resolution, "instances/s", [&]()
+        {
+            engine.update();
+            engine.display();
+            return (size_t)(side * side);
+        });
+    }
+
+    // Scene graph updates over a tree of SCENE_GRAPH_NODES nodes, four children each: moving
+    // the root, which recomputes every node, and moving one leaf in a hundred, in nodes
+    // recomputed per second.
+    void benchmarkSceneGraph()
+    {
+        cgel::SceneGraph graph;
+        graph.reserve(SCENE_GRAPH_NODES);
+        for (int i = 0; i < SCENE_GRAPH_NODES; i++)
+            graph.addNode(i ? (uint32_t)(i - 1) / 4 : cgel::SceneGraph::NO_PARENT,
+                          cgel::make_rotationY_4x4<float>(0.1f * i) * cgel::make_translation_4x4<float>({0.5f, 0, 0.1f * (i % 4), 1}));
+        graph.update();
+
+        int frame = 0;
+        measure("scene_all", "-", {0, 0}, "nodes/s", [&]()
+        {
+            graph.setLocalTransform(0, cgel::make_rotationY_4x4<float>(0.01f * frame++));
+            g_sink = graph.update();
+            return g_sink;
+        });
+
+        measure("scene_sparse", "-", {0, 0}, "nodes/s", [&]()
+        {
+            for (int i = SCENE_GRAPH_NODES - 1 - frame++ % 100; i > SCENE_GRAPH_NODES * 3 / 4; i -= 100)
+                graph.setLocalTransform(i, cgel::make_translation_4x4<float>({0.01f * frame, 0, 0, 1}));
+            g_sink = graph.update();
+            return g_sink;
+        });
+    }
+
+    std::string jsonEscape(const std::string &s)
+    {
+        std::string escaped;
+        for (const char c : s)
+        {
+            if (c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    void writeResults(FILE *file, const bool json)
+    {
+        if (json) std::fprintf(file, "[\n");
+        else std::fprintf(file, "scenario,mesh,width,height,samples,median_ms,mean_ms,p95_ms,throughput,unit\n");
+
+        for (size_t i = 0; i < g_results.size(); i++)
+        {
+            const Result &r = g_results[i];
+            if (json)
+                std::fprintf(file, "  {\"scenario\": \"%s\", \"mesh\": \"%s\", \"width\": %d, \"height\": %d, \"samples\": %zu, "
+                                   "\"median_ms\": %.6f, \"mean_ms\": %.6f, \"p95_ms\": %.6f, \"throughput\": %.1f, \"unit\": \"%s\"}%s\n",
+                             jsonEscape(r.scenario).c_str(), jsonEscape(r.mesh).c_str(), r.resolution.width, r.resolution.height, r.samples,
+                             r.medianMs, r.meanMs, r.p95Ms, r.itemsPerSecond, jsonEscape(r.unit).c_str(), i + 1 < g_results.size() ? "," : "");
+            else
+                std::fprintf(file, "%s,%s,%d,%d,%zu,%.6f,%.6f,%.6f,%.1f,%s\n", r.scenario.c_str(), r.mesh.c_str(), r.resolution.width, r.resolution.height,
+                             r.samples, r.medianMs, r.meanMs, r.p95Ms, r.itemsPerSecond, r.unit.c_str());
+        }
+
+        if (json) std::fprintf(file, "]\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    std::string outPath;
+    for (int i = 1; i < argc; i++)
+    {
+        const bool format = !std::strcmp(argv[i], "--format") && i + 1 < argc;
+        if (format && (!std::strcmp(argv[i + 1], "json") || !std::strcmp(argv[i + 1], "csv"))) json = !std::strcmp(argv[++i], "json");
+        else if (!std::strcmp(argv[i], "--out") && i + 1 < argc) outPath = argv[++i];
+        else if (!std::strcmp(argv[i], "--quick")) g_minSeconds = 0.05;
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--format csv|json] [--out file] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    try
+    {
+        for (const char *fileName : MESH_FILES)
+        {
+            const cgel::Mesh mesh = cgel::constructMeshFromCachedObjectFile(fileName);
+            benchmarkLoad(fileName);
+            benchmarkTransform(meshName(fileName), mesh);
+            benchmarkBuildLods(meshName(fileName), mesh);
+            for (const Resolution resolution : RESOLUTIONS)
+                benchmarkClip(meshName(fileName), mesh, resolution);
+        }
+        benchmarkLoadScaling();
+
+        for (const Resolution resolution : RESOLUTIONS)
+            benchmarkRaster(resolution);
+
+        benchmarkSort();
+        benchmarkSceneGraph();
+
+        for (const char *fileName : MESH_FILES)
+            for (const Resolution resolution : RESOLUTIONS)
+                benchmarkFrame(fileName, resolution);
+
+        for (const char *fileName : MESH_FILES)
+            for (const Resolution resolution : RESOLUTIONS)
+                benchmarkInstances(fileName, resolution);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    FILE *file = outPath.empty() ? stdout : std::fopen(outPath.c_str(), "w");
+    if (!file)
+    {
+        std::fprintf(stderr, "Cannot open %s for writing.\n", outPath.c_str());
+        return 1;
+    }
+    writeResults(file, json);
+    if (file != stdout) std::fclose(file);
+    return 0;
+}
@@ -1,19 +1,156 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
 #include "Graphics3DEngine.hpp"
+#include "MeshCache.hpp"
+#include "AllocationCounter.hpp"
+
+// Parse a whole decimal number greater than zero from text, up to end if given. Returns the
+// character after it, or null if text does not start with one.
+static const char *parsePositive(const char *text, int &value, const char end = '\0')
+{
+    char *rest;
+    errno = 0;
+    const long parsed = std::strtol(text, &rest, 10);
+    if (rest == text || *rest != end || errno || parsed <= 0 || parsed > INT_MAX || !std::isdigit((unsigned char)*text)) return nullptr;
+    value = (int)parsed;
+    return rest;
+}
+
+// Sort times and print their mean and spread as one labelled part of the summary line.
+static void printTimeSummary(const char *label, std::vector<double> &times)
+{
+    std::sort(times.begin(), times.end());
+    const int count = (int)times.size();
+    double total = 0;
+    for (const double time : times) total += time;
+    std::fprintf(stderr, ", %s ms: mean %.4f, min %.4f, median %.4f, p95 %.4f, max %.4f", label, total / count, times.front(), times[count / 2],
+                 times[std::min(count - 1, count * 95 / 100)], times.back());
+}
+
+// Render frameCount frames without a console while the camera circles the mesh once, and
+// print how long each frame took to stdout as CSV followed by a summary on stderr. update()
+// renders the frame and display() presents it, so their times are reported as such. With
+// countAllocations, each frame's heap allocations are reported too, and the run fails if any
+// frame after the first allocates.
+static int runHeadless(const std::string &objectFile, const int frameCount, const int width, const int height, const std::string &dumpPath, const bool hud,
+                       const bool countAllocations)
+{
+    std::unique_ptr<cgel::HeadlessBackend> backend(new cgel::HeadlessBackend(width, height, dumpPath));
+    cgel::Graphics3DEngine rw(width, height, cgel::HALF_PI, 0.01, 100, 0, std::move(backend));
+    cgel::Mesh mesh = cgel::constructMeshFromCachedObjectFile(objectFile);
+    rw.addMesh(mesh);
+    rw.setProfilerOverlay(hud);
+
+    std::vector<double> updateTimes(frameCount), displayTimes(frameCount);
+    int allocatingFrames = 0;
+    std::printf(countAllocations ? "frame,update_ms,display_ms,allocations\n" : "frame,update_ms,display_ms\n");
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+        // The path only depends on the frame number, so runs are comparable across builds.
+        rw.setCameraOrbit(mesh, 2 * cgel::PI * frame / frameCount, 0.3f);
+
+        const size_t allocationsBefore = cgel::getAllocationCount();
+        const auto start = std::chrono::steady_clock::now();
+        rw.update();
+        const auto updated = std::chrono::steady_clock::now();
+        rw.display();
+        const auto displayed = std::chrono::steady_clock::now();
+        const size_t allocations = cgel::getAllocationCount() - allocationsBefore;
+
+        updateTimes[frame] = std::chrono::duration<double, std::milli>(updated - start).count();
+        displayTimes[frame] = std::chrono::duration<double, std::milli>(displayed - updated).count();
+        if (!countAllocations)
+        {
+            std::printf("%d,%.4f,%.4f\n", frame, updateTimes[frame], displayTimes[frame]);
+            continue;
+        }
+        std::printf("%d,%.4f,%.4f,%zu\n", frame, updateTimes[frame], displayTimes[frame], allocations);
+        // The first frame sizes the engine's per-frame buffers.
+        if (frame > 0 && allocations > 0) allocatingFrames++;
+    }
 
-int main() {
+    std::fprintf(stderr, "%d frames at %dx%d", frameCount, width, height);
+    printTimeSummary("render", updateTimes);
+    printTimeSummary("present", displayTimes);
+    std::fprintf(stderr, "\n");
+    if (allocatingFrames > 0)
+    {
+        std::fprintf(stderr, "%d frames after the first allocated\n", allocatingFrames);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
 
-    // Change screen resolution here.
-    cgel::Graphics3DEngine rw(941, 400);
     //                                                        Change object file here.
     //                                                                   |
     //                                                                   v
-    cgel::Mesh mesh = cgel::constructMeshFromObjectFile("ObjectFiles/sword.obj"); 
+    const std::string objectFile = "ObjectFiles/sword.obj";
+
+    // --headless N [--size WxH] [--dump file] renders N frames offscreen and reports timings.
+    // --hud shows the profiler's per-stage times and triangle counts in the top rows.
+    // --count-allocations adds each headless frame's heap allocations and fails if a frame after
+    // the first allocates; it needs a build with -DCGEL_COUNT_ALLOCATIONS. Options that only
+    // apply to a headless run are rejected without --headless.
+    int headlessFrames = 0, width = 120, height = 40;
+    bool hud = false, countAllocations = false, headlessOption = false, valid = true;
+    std::string dumpPath;
+    for (int i = 1; i < argc && valid; i++)
+    {
+        if (!std::strcmp(argv[i], "--headless") && i + 1 < argc) valid = parsePositive(argv[++i], headlessFrames);
+        else if (!std::strcmp(argv[i], "--size") && i + 1 < argc)
+        {
+            headlessOption = true;
+            const char *rest = parsePositive(argv[++i], width, 'x');
+            valid = rest && parsePositive(rest + 1, height);
+        }
+        else if (!std::strcmp(argv[i], "--dump") && i + 1 < argc)
+        {
+            headlessOption = true;
+            dumpPath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--hud")) hud = true;
+        else if (!std::strcmp(argv[i], "--count-allocations"))
+        {
+            headlessOption = true;
+            countAllocations = true;
+        }
+        else valid = false;
+    }
+    if (!valid || (headlessOption && headlessFrames == 0))
+    {
+        std::fprintf(stderr, "Usage: %s [--hud] [--headless frames [--size WxH] [--dump file] [--count-allocations]]\n", argv[0]);
+        return 1;
+    }
+    if (countAllocations && !cgel::isAllocationCountingEnabled())
+    {
+        std::fprintf(stderr, "--count-allocations needs a build with -DCGEL_COUNT_ALLOCATIONS\n");
+        return 1;
+    }
+    if (headlessFrames > 0) return runHeadless(objectFile, headlessFrames, width, height, dumpPath, hud, countAllocations);
+
+    // Change screen resolution here, 0 fits the console window.
+    cgel::Graphics3DEngine rw(0, 0);
+    rw.setPresentMode(cgel::PRESENT_MODE_DIFF);
+    rw.setAsyncPresent(true);
+    rw.setProfilerOverlay(hud);
+    cgel::Mesh mesh = cgel::constructMeshFromCachedObjectFile(objectFile);
     rw.addMesh(mesh);
 
     while (1)
     {
         rw.update();
-        rw.display();     
+        rw.display();
     }
 
     return 0;